@@ -19,7 +19,6 @@ QStringList emailContents;
 int currentIndex = 0;
 int maxCount = 0;
 int linesPerEmail = 1;
-int retryCount = 0;
 const int MAX_RETRIES = 3;
 const int DEFAULT_INTERVAL_MS = 2000;
 QString progressFile = "mail_progress.ini";
@@ -80,13 +79,11 @@ qint64 parseTimeInterval(const QString &timeStr) {
 void saveProgress() {
     QSettings settings(progressFile, QSettings::IniFormat);
     settings.setValue("currentIndex", currentIndex);
-    settings.setValue("retryCount", retryCount);
 }
 
 void loadProgress() {
     QSettings settings(progressFile, QSettings::IniFormat);
     currentIndex = settings.value("currentIndex", 0).toInt();
-    retryCount = settings.value("retryCount", 0).toInt();
 }
 
 QStringList getEmailContent(int index) {
@@ -126,7 +123,7 @@ int workerSendMail() {
 
     QStringList content = getEmailContent(currentIndex);
     QString emailText = content.join("\n");
-    qDebug() << QString("Sending email #%1 (retry: %2/%3)").arg(currentIndex + 1).arg(retryCount).arg(MAX_RETRIES);
+    qDebug() << QString("Sending email #%1").arg(currentIndex + 1);
     
     Server server;
     server.setHost(mailConfig.smtpServer);
@@ -134,6 +131,13 @@ int workerSendMail() {
     server.setConnectionType(Server::SslConnection);
     server.setUsername(mailConfig.senderEmail);
     server.setPassword(mailConfig.senderPassword);
+    // A stalled server fails the reply after 5 seconds without progress
+    server.setConnectTimeout(5000);
+    server.setGreetingTimeout(5000);
+    server.setCommandTimeout(5000);
+    server.setSendDataTimeout(5000);
+    // Temporary failures are retried by the server with backoff
+    server.setMaxRetries(MAX_RETRIES);
 
     MimeMessage message;
     EmailAddress sender(mailConfig.senderEmail, mailConfig.senderName);
@@ -146,54 +150,35 @@ int workerSendMail() {
     text->setText(emailText);
     message.addPart(text);
 
-    ServerReply *reply = server.sendMail(message);
-    
-    int exitCode = 0;
-    bool finished = false;
-    QEventLoop loop;
-    
-    // Set 5 second timeout timer
-    QTimer *timeoutTimer = new QTimer();
-    timeoutTimer->setSingleShot(true);
-    QObject::connect(timeoutTimer, &QTimer::timeout, [&loop, &finished, &exitCode] {
-        if (!finished) {
-            qDebug() << "Send timeout (5s), marked as failed";
-            exitCode = -1;
-            finished = true;
-            loop.quit();
-        }
-    });
-    
-    QObject::connect(reply, &ServerReply::finished, [reply, &loop, &exitCode, &finished, timeoutTimer] {
-        if (!finished) {
-            timeoutTimer->stop();
-            exitCode = reply->error() ? -3 : 0;
-            finished = true;
-            loop.quit();
+    bool timedOut = false;
+    QObject::connect(&server, &Server::smtpError, [&timedOut](Server::SmtpError e, const QString &description) {
+        if (e == Server::ConnectionTimeoutError || e == Server::ResponseTimeoutError ||
+            e == Server::SendDataTimeoutError) {
+            qDebug() << "Send timeout," << description;
+            timedOut = true;
         }
-        reply->deleteLater();
     });
 
-    timeoutTimer->start(5000); // 5 second timeout
-    loop.exec();
+    ServerReply *reply = server.sendMail(message);
     
-    timeoutTimer->deleteLater();
+    QEventLoop loop;
+    QObject::connect(reply, &ServerReply::finished, &loop, &QEventLoop::quit);
+    loop.exec();
+
+    // smtpError() is emitted right after the reply finishes
+    int exitCode = 0;
+    if (reply->error()) {
+        exitCode = timedOut ? -1 : -3;
+    }
     
     if (exitCode == 0) {
         qDebug() << "Email sent successfully";
-        currentIndex++;
-        retryCount = 0;
-        saveProgress();
     } else {
-        retryCount++;
-        qDebug() << QString("Email send failed, retry count: %1/%2").arg(retryCount).arg(MAX_RETRIES);
-        if (retryCount >= MAX_RETRIES) {
-            qDebug() << "Max retries reached, skipping this email";
-            currentIndex++;
-            retryCount = 0;
-        }
-        saveProgress();
+        qDebug() << "Email send failed:" << reply->responseText() << "skipping this email";
     }
+    reply->deleteLater();
+    currentIndex++;
+    saveProgress();
     
     return exitCode;
 }
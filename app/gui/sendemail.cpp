@@ -200,7 +200,7 @@ void SendEmail::sendMailAsync(const MimeMessage &msg)
 
     const QString user = ui->username->text();
     if (!user.isEmpty()) {
-        server->setAuthMethod(Server::AuthLogin);
+        server->setAuthMethod(Server::AuthAuto);
         server->setUsername(user);
         server->setPassword(ui->password->text());
     }
@@ -454,12 +454,14 @@ void SendEmail::sendNextEmail()
         server->setHost(host);
         server->setPort(port);
         server->setConnectionType(ct);
+        // Temporary failures are retried with backoff before the reply finishes
+        server->setMaxRetries(3);
         m_aServers.push_back(server);
     }
 
     const QString user = ui->usernameSchd->text();
     if (!user.isEmpty()) {
-        server->setAuthMethod(Server::AuthLogin);
+        server->setAuthMethod(Server::AuthAuto);
         server->setUsername(user);
         server->setPassword(ui->passwordSchd->text());
     }
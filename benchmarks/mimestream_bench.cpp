@@ -0,0 +1,175 @@
+/*
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  See the LICENSE file for more details.
+*/
+#include "mimestream_p.h"
+
+#include <cstdlib>
+
+#include <QBuffer>
+#include <QElapsedTimer>
+#include <QtDebug>
+
+using namespace SimpleMail;
+
+namespace {
+
+qint64 allocations = 0;
+
+} // namespace
+
+#ifdef __GLIBC__
+// Counts the heap allocations of the process, glibc lets the
+// executable replace these and still reach the real ones
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+
+void *malloc(size_t size) __THROW
+{
+    ++allocations;
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) __THROW
+{
+    ++allocations;
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size) __THROW
+{
+    ++allocations;
+    return __libc_realloc(ptr, size);
+}
+}
+#endif
+
+namespace {
+
+// Lines of UTF-8 text ending with a bare LF, valid to be sent as 8bit
+QByteArray makeText(int size)
+{
+    const QByteArray line = QByteArrayLiteral("Caf\xc3\xa9 = 42, the quick brown fox jumps over "
+                                              "the lazy dog. Na\xc3\xafve r\xc3\xa9sum\xc3\xa9\n");
+    QByteArray ret;
+    ret.reserve(size + line.size());
+    while (ret.size() < size) {
+        ret += line;
+    }
+    return ret;
+}
+
+QByteArray makeBinary(int size)
+{
+    QByteArray ret(size, Qt::Uninitialized);
+    quint32 state = 1;
+    for (char &c : ret) {
+        state = state * 1664525u + 1013904223u;
+        c     = char(state >> 24);
+    }
+    return ret;
+}
+
+std::shared_ptr<QIODevice> makeDevice(const QByteArray &data)
+{
+    auto ret = std::make_shared<QBuffer>();
+    ret->setData(data);
+    // Unbuffered so only the allocations of the stream are counted
+    ret->open(QIODevice::ReadOnly | QIODevice::Unbuffered);
+    return ret;
+}
+
+// A text part, an attachment and a 7bit part between their headers and boundaries
+void writeMessage(MimeStream &stream, const QByteArray &text, const QByteArray &binary)
+{
+    const MimeContentFormatter formatter;
+    stream.write("Content-Type: multipart/mixed; boundary=\"b\"\r\n\r\n"
+                 "--b\r\nContent-Type: text/plain; charset=utf-8\r\n\r\n");
+    stream.appendContent(
+        makeDevice(text), MimePart::QuotedPrintable, QByteArrayLiteral("text/plain"), formatter);
+    stream.write("\r\n--b\r\nContent-Type: application/octet-stream\r\n\r\n");
+    stream.appendContent(makeDevice(binary),
+                         MimePart::Base64,
+                         QByteArrayLiteral("application/octet-stream"),
+                         formatter);
+    stream.write("\r\n--b\r\nContent-Type: text/plain\r\n\r\n");
+    stream.appendContent(makeDevice(QByteArrayLiteral("Plain 7bit text\r\n").repeated(4096)),
+                         MimePart::_7Bit,
+                         QByteArrayLiteral("text/plain"),
+                         formatter);
+    stream.write("\r\n--b--\r\n");
+}
+
+// Reads the whole stream in the blocks the socket would get
+qint64 readAll(MimeStream &stream, qint64 &reads, int &checksum)
+{
+    char block[16 * 1024];
+    qint64 bytes = 0;
+    qint64 in;
+    stream.rewind();
+    while ((in = stream.read(block, sizeof(block))) > 0) {
+        checksum += block[0];
+        bytes += in;
+        ++reads;
+    }
+    return bytes;
+}
+
+void run(const char *name, MimeStream::BodyEncoding encoding)
+{
+    const QByteArray text   = makeText(1024 * 1024);
+    const QByteArray binary = makeBinary(1024 * 1024);
+
+    MimeStream stream;
+    stream.setBodyEncoding(encoding);
+    writeMessage(stream, text, binary);
+
+    // The first pass grows the buffers to their final size
+    qint64 reads = 0;
+    int checksum = 0;
+    readAll(stream, reads, checksum);
+
+    reads                  = 0;
+    qint64 bytes           = 0;
+    const qint64 allocated = allocations;
+    QElapsedTimer timer;
+    timer.start();
+    while (timer.elapsed() < 1000) {
+        bytes += readAll(stream, reads, checksum);
+    }
+    const double seconds = double(timer.nsecsElapsed()) / 1e9;
+
+    qInfo("%-8s %8.1f MB/s %8.3f allocations/read (checksum %d)",
+          name,
+          double(bytes) / seconds / (1024 * 1024),
+          double(allocations - allocated) / double(reads),
+          checksum);
+}
+
+} // namespace
+
+int main()
+{
+#ifndef __GLIBC__
+    qInfo("Allocations are only counted with glibc");
+#endif
+
+    // Base64, quoted-printable and raw blocks
+    run("7bit", MimeStream::SevenBit);
+
+    // The text part is canonicalized to CRLF instead of being encoded
+    run("8bit", MimeStream::EightBitMime);
+
+    return 0;
+}
@@ -0,0 +1,134 @@
+/*
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  See the LICENSE file for more details.
+*/
+#include "server_p.h"
+
+#include <QElapsedTimer>
+#include <QList>
+#include <QtDebug>
+
+using namespace SimpleMail;
+
+namespace {
+
+enum {
+    QueuedMails = 100000,
+    TakeAtCalls = 1000,
+};
+
+// The queued mail before it became move-only, copied around by QList
+class LegacyContainer
+{
+public:
+    explicit LegacyContainer(const MimeMessage &email)
+        : msg(email)
+    {
+    }
+
+    MimeMessage msg;
+    QPointer<ServerReply> reply;
+    std::shared_ptr<MimeStream> stream;
+    QByteArrayList commands;
+    QList<int> awaitedCodes;
+    QList<ServerReply::RecipientStatus> recipients;
+    QList<int> recipientIndex;
+    QList<int> deferred;
+    std::shared_ptr<EnvelopeShards> shards;
+    QString errorText;
+    int errorCode          = 0;
+    int awaitedPos         = 0;
+    int acceptedRecipients = 0;
+    bool failed            = false;
+};
+
+// An envelope of two recipients, as processNextMail() builds it
+ServerReplyContainer makeMail(const MimeMessage &msg, RingBuffer<ServerReplyContainer> *)
+{
+    ServerReplyContainer ret(msg);
+    ret.addCommand(QByteArrayLiteral("MAIL FROM:<sender@example.com>\r\n"), 250);
+    for (int i = 0; i < 2; ++i) {
+        ServerReply::RecipientStatus status;
+        status.address = QStringLiteral("rcpt%1@example.com").arg(i);
+        ret.recipients.append(status);
+        ret.addCommand("RCPT TO:<" + status.address.toLatin1() + ">\r\n", 250);
+    }
+    ret.addCommand(QByteArrayLiteral("DATA\r\n"), 354);
+    return ret;
+}
+
+LegacyContainer makeMail(const MimeMessage &msg, QList<LegacyContainer> *)
+{
+    LegacyContainer ret(msg);
+    ret.commands.append(QByteArrayLiteral("MAIL FROM:<sender@example.com>\r\n"));
+    ret.awaitedCodes.append(250);
+    for (int i = 0; i < 2; ++i) {
+        ServerReply::RecipientStatus status;
+        status.address = QStringLiteral("rcpt%1@example.com").arg(i);
+        ret.recipients.append(status);
+        ret.commands.append("RCPT TO:<" + status.address.toLatin1() + ">\r\n");
+        ret.awaitedCodes.append(250);
+    }
+    ret.commands.append(QByteArrayLiteral("DATA\r\n"));
+    ret.awaitedCodes.append(354);
+    return ret;
+}
+
+void report(const char *name, const char *operation, qint64 nsecs, int calls)
+{
+    qInfo("%-10s %-10s %10.1f ns/op", name, operation, double(nsecs) / calls);
+}
+
+// Fills the queue, takes the mail behind the current one as a pipelined
+// envelope does and then sends them all
+template <typename Queue>
+void run(const char *name)
+{
+    const MimeMessage msg;
+    Queue queue;
+    int checksum = 0;
+
+    QElapsedTimer timer;
+    timer.start();
+    for (int i = 0; i < QueuedMails; ++i) {
+        queue.append(makeMail(msg, &queue));
+    }
+    report(name, "push", timer.nsecsElapsed(), QueuedMails);
+
+    timer.restart();
+    for (int i = 0; i < TakeAtCalls; ++i) {
+        auto mail = queue.takeAt(1);
+        checksum += mail.recipients.size();
+        queue.append(std::move(mail));
+    }
+    report(name, "takeAt(1)", timer.nsecsElapsed(), TakeAtCalls);
+
+    timer.restart();
+    while (!queue.isEmpty()) {
+        checksum += queue.takeFirst().recipients.size();
+    }
+    report(name, "pop", timer.nsecsElapsed(), QueuedMails);
+
+    qInfo("%-10s checksum %d", name, checksum);
+}
+
+} // namespace
+
+int main()
+{
+    run<RingBuffer<ServerReplyContainer>>("RingBuffer");
+
+    // How mails were queued before
+    run<QList<LegacyContainer>>("QList");
+
+    return 0;
+}
@@ -0,0 +1,97 @@
+/*
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  See the LICENSE file for more details.
+*/
+#include "replyparser_p.h"
+
+#include <QBuffer>
+#include <QElapsedTimer>
+#include <QtDebug>
+
+using namespace SimpleMail;
+
+namespace {
+
+// What a pipelining server answers to EHLO and to an envelope of 8 recipients
+QByteArray replyBatch()
+{
+    QByteArray ret = QByteArrayLiteral("250-smtp.example.com at your service\r\n"
+                                       "250-SIZE 35882577\r\n"
+                                       "250-8BITMIME\r\n"
+                                       "250-PIPELINING\r\n"
+                                       "250-CHUNKING\r\n"
+                                       "250 SMTPUTF8\r\n"
+                                       "250 2.1.0 OK\r\n");
+    for (int i = 0; i < 8; ++i) {
+        ret += QByteArrayLiteral("250 2.1.5 OK\r\n");
+    }
+    ret += QByteArrayLiteral("354 Go ahead\r\n"
+                             "250 2.0.0 OK 1700000000 queued as 4A2B\r\n");
+    return ret;
+}
+
+// Parses the batch over and over for about a second
+template <typename Parse>
+void run(const char *name, const QByteArray &batch, Parse parse)
+{
+    QBuffer device;
+    device.setData(batch);
+    device.open(QIODevice::ReadOnly);
+
+    qint64 replies = 0;
+    int checksum   = 0;
+    QElapsedTimer timer;
+    timer.start();
+    while (timer.elapsed() < 1000) {
+        for (int i = 0; i < 1000; ++i) {
+            device.seek(0);
+            replies += parse(&device, checksum);
+        }
+    }
+
+    const double seconds = double(timer.nsecsElapsed()) / 1e9;
+    qInfo("%-12s %12.0f replies/s (checksum %d)", name, double(replies) / seconds, checksum);
+}
+
+} // namespace
+
+int main()
+{
+    const QByteArray batch = replyBatch();
+
+    ReplyParser parser;
+    run("ReplyParser", batch, [&parser](QIODevice *device, int &checksum) {
+        int replies = 0;
+        parser.feed(device);
+        while (parser.next()) {
+            checksum += parser.code() + parser.text().size() + parser.enhancedStatus().size();
+            ++replies;
+        }
+        return replies;
+    });
+
+    // How replies were read before, a few allocations for every line
+    run("readLine", batch, [](QIODevice *device, int &checksum) {
+        int replies = 0;
+        while (device->canReadLine()) {
+            const QString line = QString::fromLatin1(device->readLine().trimmed());
+            if (line.size() > 3 && line.at(3) == QLatin1Char('-')) {
+                continue;
+            }
+            checksum += line.left(3).toInt() + line.mid(4).size();
+            ++replies;
+        }
+        return replies;
+    });
+
+    return 0;
+}
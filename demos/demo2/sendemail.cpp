@@ -119,7 +119,7 @@ void SendEmail::sendMailAsync(const MimeMessage &msg)
 
     const QString user = ui->username->text();
     if (!user.isEmpty()) {
-        server->setAuthMethod(Server::AuthLogin);
+        server->setAuthMethod(Server::AuthAuto);
         server->setUsername(user);
         server->setPassword(ui->password->text());
     }
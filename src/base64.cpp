@@ -0,0 +1,253 @@
+/*
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  See the LICENSE file for more details.
+*/
+#include "base64_p.h"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define SIMPLEMAIL_BASE64_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define SIMPLEMAIL_TARGET(features) __attribute__((target(features)))
+#else
+#define SIMPLEMAIL_TARGET(features)
+#endif
+
+using namespace SimpleMail;
+
+namespace {
+
+const char Alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+// Encodes and pads the input, returns the end of the output
+char *encodeScalar(const unsigned char *in, int size, char *out)
+{
+    const unsigned char *end = in + size - size % 3;
+    while (in < end) {
+        const unsigned int group = (unsigned(in[0]) << 16) | (unsigned(in[1]) << 8) | in[2];
+        out[0]                   = Alphabet[group >> 18];
+        out[1]                   = Alphabet[(group >> 12) & 0x3f];
+        out[2]                   = Alphabet[(group >> 6) & 0x3f];
+        out[3]                   = Alphabet[group & 0x3f];
+        in += 3;
+        out += 4;
+    }
+
+    if (size % 3) {
+        const unsigned int group = (unsigned(in[0]) << 16) | (size % 3 == 2 ? in[1] << 8 : 0);
+        out[0]                   = Alphabet[group >> 18];
+        out[1]                   = Alphabet[(group >> 12) & 0x3f];
+        out[2]                   = size % 3 == 2 ? Alphabet[(group >> 6) & 0x3f] : '=';
+        out[3]                   = '=';
+        out += 4;
+    }
+    return out;
+}
+
+// Encodes groups of 12 input bytes out of \p size, the loads might read up to
+// \p readable bytes from \p in, returns the number of bytes consumed
+using Kernel = int (*)(const unsigned char *in, int size, int readable, char *out);
+
+#ifdef SIMPLEMAIL_BASE64_X86
+/*
+ * The 3 bytes of each group are spread over a 32 bit lane, the 4 indices are
+ * moved into place with multiplications and translated to the alphabet by
+ * adding the offset of their range, picked with a byte shuffle.
+ */
+SIMPLEMAIL_TARGET("ssse3")
+inline __m128i indicesSsse3(__m128i input)
+{
+    const __m128i spread = _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1);
+    input                = _mm_shuffle_epi8(input, spread);
+    const __m128i high   = _mm_mulhi_epu16(_mm_and_si128(input, _mm_set1_epi32(0x0fc0fc00)),
+                                         _mm_set1_epi32(0x04000040));
+    const __m128i low    = _mm_mullo_epi16(_mm_and_si128(input, _mm_set1_epi32(0x003f03f0)),
+                                        _mm_set1_epi32(0x01000010));
+    return _mm_or_si128(high, low);
+}
+
+SIMPLEMAIL_TARGET("ssse3")
+inline __m128i translateSsse3(__m128i indices)
+{
+    // 0 for a-z, 1-10 for 0-9, 11 for +, 12 for / and 13 for A-Z
+    __m128i range    = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+    const __m128i az = _mm_cmpgt_epi8(_mm_set1_epi8(26), indices);
+    range            = _mm_or_si128(range, _mm_and_si128(az, _mm_set1_epi8(13)));
+
+    const __m128i offsets = _mm_setr_epi8(
+        'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+        '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+    return _mm_add_epi8(_mm_shuffle_epi8(offsets, range), indices);
+}
+
+SIMPLEMAIL_TARGET("ssse3")
+int encodeSsse3(const unsigned char *in, int size, int readable, char *out)
+{
+    int done = 0;
+    // 16 bytes are loaded for the 12 encoded
+    while (done + 12 <= size && done + 16 <= readable) {
+        const __m128i input = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + done));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + done / 3 * 4),
+                         translateSsse3(indicesSsse3(input)));
+        done += 12;
+    }
+    return done;
+}
+
+// Same as the SSSE3 kernel, the shuffles work on each 128 bit lane on it's own
+SIMPLEMAIL_TARGET("avx2")
+inline __m256i indicesAvx2(__m256i input)
+{
+    const __m256i spread = _mm256_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1,
+                                           10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1);
+    input                = _mm256_shuffle_epi8(input, spread);
+
+    const __m256i high = _mm256_mulhi_epu16(_mm256_and_si256(input, _mm256_set1_epi32(0x0fc0fc00)),
+                                            _mm256_set1_epi32(0x04000040));
+    const __m256i low  = _mm256_mullo_epi16(_mm256_and_si256(input, _mm256_set1_epi32(0x003f03f0)),
+                                           _mm256_set1_epi32(0x01000010));
+    return _mm256_or_si256(high, low);
+}
+
+SIMPLEMAIL_TARGET("avx2")
+inline __m256i translateAvx2(__m256i indices)
+{
+    __m256i range    = _mm256_subs_epu8(indices, _mm256_set1_epi8(51));
+    const __m256i az = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), indices);
+    range            = _mm256_or_si256(range, _mm256_and_si256(az, _mm256_set1_epi8(13)));
+
+    const __m256i offsets = _mm256_setr_epi8(
+        'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+        '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0, 'a' - 26, '0' - 52, '0' - 52, '0' - 52,
+        '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63,
+        'A', 0, 0);
+    return _mm256_add_epi8(_mm256_shuffle_epi8(offsets, range), indices);
+}
+
+SIMPLEMAIL_TARGET("avx2")
+int encodeAvx2(const unsigned char *in, int size, int readable, char *out)
+{
+    int done = 0;
+    // Each lane takes 12 bytes, the upper load ends 28 bytes ahead
+    while (done + 24 <= size && done + 28 <= readable) {
+        const auto *lower   = reinterpret_cast<const __m128i *>(in + done);
+        const auto *upper   = reinterpret_cast<const __m128i *>(in + done + 12);
+        const __m256i input = _mm256_inserti128_si256(
+            _mm256_castsi128_si256(_mm_loadu_si128(lower)), _mm_loadu_si128(upper), 1);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + done / 3 * 4),
+                            translateAvx2(indicesAvx2(input)));
+        done += 24;
+    }
+
+    // A last group of 12 fits in a 128 bit load
+    return done + encodeSsse3(in + done, size - done, readable - done, out + done / 3 * 4);
+}
+#endif
+
+Kernel selectKernel()
+{
+#if defined(SIMPLEMAIL_BASE64_X86) && defined(__GNUC__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return encodeAvx2;
+    }
+    if (__builtin_cpu_supports("ssse3")) {
+        return encodeSsse3;
+    }
+#elif defined(SIMPLEMAIL_BASE64_X86) && defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    const int maxLeaf = info[0];
+
+    __cpuid(info, 1);
+    const bool ssse3 = info[2] & (1 << 9);
+    // AVX registers must also be saved by the OS
+    const bool avx =
+        (info[2] & (1 << 27)) && (info[2] & (1 << 28)) && (_xgetbv(0) & 0x6) == 0x6;
+    if (avx && maxLeaf >= 7) {
+        __cpuidex(info, 7, 0);
+        if (info[1] & (1 << 5)) {
+            return encodeAvx2;
+        }
+    }
+    if (ssse3) {
+        return encodeSsse3;
+    }
+#endif
+    return nullptr;
+}
+
+inline Kernel kernel()
+{
+    static const Kernel ret = selectKernel();
+    return ret;
+}
+
+} // namespace
+
+int Base64::wrappedSize(int size, int lineLength)
+{
+    if (size <= 0) {
+        return 0;
+    }
+
+    lineLength        = std::max(1, lineLength);
+    const int encoded = (size + 2) / 3 * 4;
+    return encoded + (encoded + lineLength - 1) / lineLength * 2;
+}
+
+int Base64::encodeWrapped(const char *data, int size, char *out, int lineLength)
+{
+    if (size <= 0) {
+        return 0;
+    }
+
+    lineLength        = std::max(1, lineLength);
+    const auto *in    = reinterpret_cast<const unsigned char *>(data);
+    const Kernel bulk = kernel();
+    char *const begin = out;
+
+    if (lineLength % 4 == 0) {
+        // Lines hold whole groups, each one is encoded right before it's CRLF
+        const int lineBytes = lineLength / 4 * 3;
+        for (int pos = 0; pos < size; pos += lineBytes) {
+            const int count = std::min(lineBytes, size - pos);
+            const int done  = bulk ? bulk(in + pos, count, size - pos, out) : 0;
+            out             = encodeScalar(in + pos + done, count - done, out + done / 3 * 4);
+            *out++          = '\r';
+            *out++          = '\n';
+        }
+        return int(out - begin);
+    }
+
+    // Groups straddle the lines, so it's all encoded first and the lines
+    // are moved apart for their CRLF starting from the last one
+    const int done    = bulk ? bulk(in, size, size, out) : 0;
+    const int encoded = int(encodeScalar(in + done, size - done, out + done / 3 * 4) - out);
+    const int lines   = (encoded + lineLength - 1) / lineLength;
+    for (int line = lines - 1; line >= 0; --line) {
+        const int length = std::min(lineLength, encoded - line * lineLength);
+        char *lineOut     = out + line * (lineLength + 2);
+        memmove(lineOut, out + line * lineLength, size_t(length));
+        lineOut[length]     = '\r';
+        lineOut[length + 1] = '\n';
+    }
+    return encoded + lines * 2;
+}
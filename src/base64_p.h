@@ -0,0 +1,45 @@
+/*
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  See the LICENSE file for more details.
+*/
+#ifndef BASE64_P_H
+#define BASE64_P_H
+
+namespace SimpleMail {
+
+/**
+ * Base64 encoder that writes the lines, already wrapped with CRLF,
+ * straight into the output buffer.
+ *
+ * Whole groups of input go through an AVX2 or SSSE3 kernel picked
+ * at runtime from what the CPU supports, the rest is encoded with
+ * a scalar loop.
+ */
+class Base64
+{
+public:
+    /**
+     * Returns the number of bytes encodeWrapped() writes for \p size input bytes
+     */
+    static int wrappedSize(int size, int lineLength);
+
+    /**
+     * Encodes \p size bytes of \p data padding the last group, a CRLF is
+     * written after every \p lineLength characters and after the last line.
+     * \p out must hold wrappedSize() bytes, the number written is returned.
+     */
+    static int encodeWrapped(const char *data, int size, char *out, int lineLength);
+};
+
+} // namespace SimpleMail
+
+#endif // BASE64_P_H
@@ -0,0 +1,98 @@
+/*
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  See the LICENSE file for more details.
+*/
+#include "dotstuffingdevice_p.h"
+
+#include <cstring>
+
+using namespace SimpleMail;
+
+DotStuffingDevice::DotStuffingDevice(QIODevice *source)
+    : m_source(source)
+{
+    open(QIODevice::ReadOnly | QIODevice::Unbuffered);
+}
+
+DotStuffingDevice::~DotStuffingDevice() = default;
+
+bool DotStuffingDevice::isSequential() const
+{
+    return true;
+}
+
+qint64 DotStuffingDevice::readData(char *data, qint64 maxSize)
+{
+    // What didn't fit the previous read goes first
+    const qint64 carried = qMin<qint64>(m_carry.size(), maxSize);
+    memcpy(data, m_carry.constData(), size_t(carried));
+    m_carry.remove(0, int(carried));
+    if (carried == maxSize) {
+        return carried;
+    }
+
+    const qint64 in = m_source->read(data + carried, maxSize - carried);
+    if (in <= 0) {
+        return in < 0 ? -1 : carried;
+    }
+
+    char *begin     = data + carried;
+    const char *end = begin + in;
+    m_dots.clear();
+    if (m_lineStart && *begin == '.') {
+        m_dots.push_back(begin);
+    }
+    const char *line = begin;
+    while ((line = static_cast<const char *>(memchr(line, '\n', size_t(end - line))))) {
+        if (++line == end) {
+            break;
+        }
+        if (*line == '.') {
+            m_dots.push_back(line);
+        }
+    }
+    m_lineStart = end[-1] == '\n';
+
+    if (m_dots.empty()) {
+        return carried + in;
+    }
+
+    // Each part of the data moves right by the number of dots before it,
+    // starting from the last so nothing is overwritten before it's moved
+    const qint64 total = carried + in + qint64(m_dots.size());
+    m_carry.resize(int(qMax<qint64>(0, total - maxSize)));
+    const auto place = [&](const char *from, qint64 size, qint64 at) {
+        const qint64 fits = qBound<qint64>(0, maxSize - at, size);
+        if (fits < size) {
+            memcpy(m_carry.data() + (at + fits - maxSize), from + fits, size_t(size - fits));
+        }
+        memmove(data + at, from, size_t(fits));
+    };
+
+    const char *partEnd = end;
+    for (size_t i = m_dots.size(); i-- > 0;) {
+        const char *dot = m_dots[i];
+        place(dot, partEnd - dot, (dot - data) + qint64(i) + 1);
+        place(".", 1, (dot - data) + qint64(i));
+        partEnd = dot;
+    }
+    return qMin(total, maxSize);
+}
+
+qint64 DotStuffingDevice::writeData(const char *data, qint64 len)
+{
+    Q_UNUSED(data)
+    Q_UNUSED(len)
+    return -1;
+}
+
+#include "moc_dotstuffingdevice_p.cpp"
@@ -0,0 +1,55 @@
+/*
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  See the LICENSE file for more details.
+*/
+#ifndef DOTSTUFFINGDEVICE_P_H
+#define DOTSTUFFINGDEVICE_P_H
+
+#include <vector>
+
+#include <QIODevice>
+
+namespace SimpleMail {
+
+/**
+ * A sequential device that reads the message from \p source doubling
+ * the dots that start a line, so the DATA command can't see the end
+ * of the message in it's content (RFC 5321 section 4.5.2).
+ *
+ * Reads go straight into the caller buffer, which is only rearranged
+ * when a line starting with a dot is found. The bytes pushed past the
+ * end of the buffer by the extra dots are returned by the next read.
+ */
+class DotStuffingDevice : public QIODevice
+{
+    Q_OBJECT
+public:
+    explicit DotStuffingDevice(QIODevice *source);
+    ~DotStuffingDevice() override;
+
+    bool isSequential() const override;
+
+protected:
+    qint64 readData(char *data, qint64 maxSize) override;
+    qint64 writeData(const char *data, qint64 len) override;
+
+private:
+    QIODevice *m_source;
+    QByteArray m_carry;
+    // Dots found by the last read, kept for it's capacity
+    std::vector<const char *> m_dots;
+    bool m_lineStart = true;
+};
+
+} // namespace SimpleMail
+
+#endif // DOTSTUFFINGDEVICE_P_H
@@ -27,45 +27,62 @@ MimeContentFormatter::MimeContentFormatter(int max_length)
 
 QByteArray MimeContentFormatter::format(const QByteArray &content, int &chars) const
 {
+    const int maxLength = qMax(1, max_length);
     QByteArray out;
-    out.reserve(6000);
+    out.reserve(content.size() + (content.size() / maxLength + 1) * 2);
+
+    const char *data = content.constData();
+    const char *end  = data + content.size();
+    while (data < end) {
+        // The line is only broken once there is more to put on it
+        if (chars >= maxLength) {
+            out.append("\r\n", 2);
+            chars = 0;
+        }
 
-    for (int i = 0, size = content.length(); i < size; i += max_length) {
-        out.append(content.mid(i, max_length));
-        out.append(QByteArrayLiteral("\r\n"));
-        chars += i;
+        const int count = int(qMin<qint64>(maxLength - chars, end - data));
+        out.append(data, count);
+        data += count;
+        chars += count;
     }
 
+    if (chars > 0 && !content.isEmpty()) {
+        out.append("\r\n", 2);
+        chars = 0;
+    }
     return out;
 }
 
 QByteArray MimeContentFormatter::formatQuotedPrintable(const QByteArray &content, int &chars) const
 {
+    const int size = content.size();
     QByteArray out;
+    out.reserve(size + (size / qMax(1, max_length - 3) + 1) * 4);
 
-    for (int i = 0; i < content.length(); ++i) {
+    const char *data = content.constData();
+    for (int i = 0; i < size; ++i) {
+        const char c = data[i];
         chars++;
 
-        if (content[i] == '\n') { // new line
-            out.append(content[i]);
+        if (c == '\n') { // new line
+            out.append(c);
             chars = 0;
             continue;
         }
 
-        if ((chars > max_length - 1) || ((content[i] == '=') && (chars > max_length - 3))) {
-            out.append(QByteArrayLiteral("=\r\n"));
+        if ((chars > max_length - 1) || ((c == '=') && (chars > max_length - 3))) {
+            out.append("=\r\n", 3);
             chars = 1;
         }
 
         // dot stuffing: https://www.rfc-editor.org/rfc/rfc5321#section-4.5.2
-        if (chars == 1 && content[i] == '.') {
+        if (chars == 1 && c == '.') {
             out.append('.');
             chars++;
         }
 
-        out.append(content[i]);
+        out.append(c);
     }
-
     return out;
 }
 
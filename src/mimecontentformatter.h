@@ -30,7 +30,17 @@ public:
     void setMaxLength(int l);
     int maxLength() const;
 
+    /**
+     * Breaks \p content in lines of maxLength() characters, each one
+     * ending with CRLF, \p chars is 0 afterwards.
+     */
     QByteArray format(const QByteArray &content, int &chars) const;
+
+    /**
+     * Breaks quoted-printable content in lines of at most maxLength(),
+     * lines starting with a dot get it doubled as required by the SMTP
+     * DATA command.
+     */
     QByteArray formatQuotedPrintable(const QByteArray &content, int &chars) const;
 
 protected:
@@ -17,6 +17,8 @@ x
 */
 
 #include "mimemessage_p.h"
+#include "mimepart_p.h"
+#include "mimestream_p.h"
 #include "quotedprintable.h"
 
 #include <typeinfo>
@@ -135,6 +137,16 @@ bool MimeMessage::write(QIODevice *device) const
     return true;
 }
 
+qint64 MimeMessage::encodedSize() const
+{
+    // Only headers are rendered, parts content is just referenced
+    MimeStream stream;
+    if (!write(&stream)) {
+        return -1;
+    }
+    return stream.encodedSize();
+}
+
 void MimeMessage::setSender(const EmailAddress &sender)
 {
     d->sender = sender;
@@ -247,6 +259,15 @@ QList<std::shared_ptr<MimePart>> MimeMessage::parts() const
 
 MimeMessagePrivate::~MimeMessagePrivate() = default;
 
+MimeMessage MimeMessagePrivate::detachedCopy(const MimeMessage &msg)
+{
+    MimeMessage ret(msg);
+    if (msg.d->content) {
+        ret.d->content = MimePartPrivate::detachedCopy(*msg.d->content);
+    }
+    return ret;
+}
+
 QByteArray MimeMessagePrivate::encode(const QByteArray &addressKind,
                                       const QList<EmailAddress> &emails,
                                       MimePart::Encoding codec)
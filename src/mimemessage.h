@@ -71,8 +71,19 @@ public:
 
     bool write(QIODevice *device) const;
 
+    /**
+     * Returns the number of bytes write() produces, computed from the
+     * parts sizes without encoding their content, or -1 if it can't
+     * be known, like when a part reads from a sequential device.
+     *
+     * The Date header is generated on each write() so the result might
+     * differ by a few bytes if the message is written at another time.
+     */
+    qint64 encodedSize() const;
+
 protected:
     QSharedDataPointer<MimeMessagePrivate> d;
+    friend class MimeMessagePrivate;
 };
 
 } // namespace SimpleMail
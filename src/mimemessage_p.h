@@ -31,6 +31,12 @@ public:
     MimeMessagePrivate() = default;
     ~MimeMessagePrivate();
 
+    /**
+     * Returns a copy of \p msg that shares no content device with it,
+     * see MimePartPrivate::detachedCopy()
+     */
+    static MimeMessage detachedCopy(const MimeMessage &msg);
+
     inline static QByteArray encode(const QByteArray &addressKind,
                                     const QList<EmailAddress> &emails,
                                     MimePart::Encoding codec);
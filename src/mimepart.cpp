@@ -15,13 +15,18 @@
   See the LICENSE file for more details.
 */
 
+#include "base64_p.h"
+#include "mimemultipart.h"
 #include "mimepart_p.h"
-#include "quotedprintable.h"
+#include "mimestream_p.h"
+#include "quotedprintable_p.h"
 
 #include <memory>
 
 #include <QtCore/QBuffer>
 #include <QtCore/QDebug>
+#include <QtCore/QFile>
+#include <QtCore/QTemporaryFile>
 #include <QtCore/QIODevice>
 
 using namespace SimpleMail;
@@ -179,6 +184,7 @@ void MimePart::setData(const QString &data)
     case _8Bit:
     case Base64:
     case QuotedPrintable:
+    case Binary:
         d->contentDevice->write(data.toUtf8());
         break;
     }
@@ -198,13 +204,14 @@ QString MimePart::data() const
         ret = QString::fromLatin1(d->contentDevice->readAll());
         break;
     case _8Bit:
+    case Binary:
         ret = QString::fromUtf8(d->contentDevice->readAll());
         break;
     case Base64:
         ret = QString::fromUtf8(QByteArray::fromBase64(d->contentDevice->readAll()));
         break;
     case QuotedPrintable:
-        ret = QString::fromUtf8(QuotedPrintable::decode(d->contentDevice->readAll()));
+        ret = QString::fromUtf8(QuotedPrintablePrivate::decode(d->contentDevice.get()));
         break;
     }
     return ret;
@@ -220,6 +227,13 @@ bool MimePart::write(QIODevice *device)
 {
     Q_D(const MimePart);
 
+    // The stream might send the content without encoding if the server allows
+    auto stream                    = qobject_cast<MimeStream *>(device);
+    const Encoding contentEncoding = stream ? stream->transferEncoding(d->contentDevice.get(),
+                                                                       d->contentEncoding,
+                                                                       d->contentType)
+                                            : d->contentEncoding;
+
     QByteArray headers;
 
     // Content-Type
@@ -237,7 +251,7 @@ bool MimePart::write(QIODevice *device)
     headers.append("\r\n");
 
     // Content-Transfer-Encoding
-    switch (d->contentEncoding) {
+    switch (contentEncoding) {
     case _7Bit:
         headers.append("Content-Transfer-Encoding: 7bit\r\n");
         break;
@@ -250,6 +264,9 @@ bool MimePart::write(QIODevice *device)
     case QuotedPrintable:
         headers.append("Content-Transfer-Encoding: quoted-printable\r\n");
         break;
+    case Binary:
+        headers.append("Content-Transfer-Encoding: binary\r\n");
+        break;
     }
 
     // Content-Id
@@ -288,23 +305,30 @@ bool MimePart::writeData(QIODevice *device)
         return false;
     }
 
-    switch (d->contentEncoding) {
-    case MimePart::_7Bit:
-    case MimePart::_8Bit:
-        if (!d->writeRaw(input, device)) {
-            return false;
-        }
-        break;
-    case MimePart::Base64:
-        if (!d->writeBase64(input, device)) {
-            return false;
-        }
-        break;
-    case MimePart::QuotedPrintable:
-        if (!d->writeQuotedPrintable(input, device)) {
-            return false;
+    auto stream = qobject_cast<MimeStream *>(device);
+    if (stream) {
+        // Content is encoded lazily while the stream is read
+        stream->appendContent(d->contentDevice, d->contentEncoding, d->contentType, d->formatter);
+    } else {
+        switch (d->contentEncoding) {
+        case MimePart::_7Bit:
+        case MimePart::_8Bit:
+        case MimePart::Binary:
+            if (!d->writeRaw(input, device)) {
+                return false;
+            }
+            break;
+        case MimePart::Base64:
+            if (!d->writeBase64(input, device)) {
+                return false;
+            }
+            break;
+        case MimePart::QuotedPrintable:
+            if (!d->writeQuotedPrintable(input, device)) {
+                return false;
+            }
+            break;
         }
-        break;
     }
 
     if (device->write("\r\n", 2) != 2) {
@@ -323,7 +347,7 @@ MimePartPrivate::~MimePartPrivate() = default;
 
 bool MimePartPrivate::writeRaw(QIODevice *input, QIODevice *out)
 {
-    char block[4096];
+    char block[BlockSize];
     while (!input->atEnd()) {
         qint64 in = input->read(block, sizeof(block));
         if (in <= 0) {
@@ -339,18 +363,15 @@ bool MimePartPrivate::writeRaw(QIODevice *input, QIODevice *out)
 
 bool MimePartPrivate::writeBase64(QIODevice *input, QIODevice *out)
 {
-    char block[6000]; // Must be powers of 6
-    int chars = 0;
+    char block[Base64BlockSize];
+    QByteArray encoded;
     while (!input->atEnd()) {
         qint64 in = input->read(block, sizeof(block));
         if (in <= 0) {
             break;
         }
 
-        // removed QByteArray::OmitTrailingEquals flag to generate ending == to ensure compatability
-        // with Amazon SES
-        QByteArray encoded = QByteArray(block, int(in)).toBase64(QByteArray::Base64Encoding);
-        encoded            = formatter.format(encoded, chars);
+        encodeBase64(block, int(in), formatter, encoded);
         if (encoded.size() != out->write(encoded)) {
             return false;
         }
@@ -360,7 +381,8 @@ bool MimePartPrivate::writeBase64(QIODevice *input, QIODevice *out)
 
 bool MimePartPrivate::writeQuotedPrintable(QIODevice *input, QIODevice *out)
 {
-    char block[4096];
+    char block[BlockSize];
+    QByteArray encoded;
     int chars = 0;
     while (!input->atEnd()) {
         qint64 in = input->read(block, sizeof(block));
@@ -368,11 +390,111 @@ bool MimePartPrivate::writeQuotedPrintable(QIODevice *input, QIODevice *out)
             break;
         }
 
-        QByteArray encoded = QuotedPrintable::encode(QByteArray(block, int(in)), false);
-        encoded            = formatter.formatQuotedPrintable(encoded, chars);
+        encodeQuotedPrintable(block, int(in), formatter, chars, encoded);
         if (encoded.size() != out->write(encoded)) {
             return false;
         }
     }
     return true;
 }
+
+void MimePartPrivate::encodeBase64(const char *data,
+                                   int size,
+                                   const MimeContentFormatter &formatter,
+                                   QByteArray &out)
+{
+    // Always padded with ending == to ensure compatability with Amazon SES,
+    // each block is wrapped on it's own as base64Size() expects
+    const int encodedSize = Base64::wrappedSize(size, formatter.maxLength());
+    out.reserve(encodedSize);
+    out.resize(encodedSize);
+    Base64::encodeWrapped(data, size, out.data(), formatter.maxLength());
+}
+
+void MimePartPrivate::encodeQuotedPrintable(const char *data,
+                                            int size,
+                                            const MimeContentFormatter &formatter,
+                                            int &chars,
+                                            QByteArray &out)
+{
+    QuotedPrintablePrivate::encodeBody(data, size, formatter.maxLength(), chars, out);
+}
+
+std::shared_ptr<MimePart> MimePartPrivate::detachedCopy(const MimePart &part)
+{
+    const MimePartPrivate *d = part.d_ptr.constData();
+
+    std::shared_ptr<MimePart> ret;
+    if (const auto multiPart = dynamic_cast<const MimeMultiPart *>(&part)) {
+        auto copy = std::make_shared<MimeMultiPart>(multiPart->mimeType());
+        for (const std::shared_ptr<MimePart> &child : multiPart->parts()) {
+            copy->addPart(detachedCopy(*child));
+        }
+        ret = copy;
+    } else {
+        // Only multipart changes how a part is written
+        ret = std::make_shared<MimePart>();
+    }
+
+    MimePartPrivate *copy = ret->d_ptr.data();
+    copy->header          = d->header;
+    copy->contentId       = d->contentId;
+    copy->contentName     = d->contentName;
+    copy->contentType     = d->contentType;
+    copy->contentCharset  = d->contentCharset;
+    copy->contentBoundary = d->contentBoundary;
+    copy->formatter       = d->formatter;
+    copy->contentEncoding = d->contentEncoding;
+
+    // A temporary file might be removed with the original part
+    QIODevice *input = d->contentDevice.get();
+    auto file        = qobject_cast<QFile *>(input);
+    if (file && !qobject_cast<QTemporaryFile *>(file) && !file->fileName().isEmpty()) {
+        copy->contentDevice = std::make_shared<QFile>(file->fileName());
+    } else if (input) {
+        auto buffer = std::make_shared<QBuffer>();
+        buffer->open(QBuffer::ReadWrite);
+        if ((input->isOpen() || input->open(QIODevice::ReadOnly)) &&
+            (input->isSequential() || input->seek(0))) {
+            buffer->write(input->readAll());
+        }
+        copy->contentDevice = buffer;
+    }
+    return ret;
+}
+
+qint64 MimePartPrivate::base64Size(qint64 size, const MimeContentFormatter &formatter)
+{
+    // Each block read is encoded and wrapped on it's own, so the
+    // last line of every block might be shorter
+    const qint64 maxLength = qMax(1, formatter.maxLength());
+    const auto blockSize   = [maxLength](qint64 in) -> qint64 {
+        if (in == 0) {
+            return 0;
+        }
+        const qint64 encoded = (in + 2) / 3 * 4;
+        const qint64 lines   = (encoded + maxLength - 1) / maxLength;
+        return encoded + lines * 2;
+    };
+
+    return size / Base64BlockSize * blockSize(Base64BlockSize) +
+           blockSize(size % Base64BlockSize);
+}
+
+qint64 MimePartPrivate::quotedPrintableSize(QIODevice *input, const MimeContentFormatter &formatter)
+{
+    if (!input->seek(0)) {
+        return -1;
+    }
+
+    // Read in the same blocks as encodeQuotedPrintable() gets them
+    char block[BlockSize];
+    qint64 ret = 0;
+    int chars  = 0;
+    qint64 in;
+    while ((in = input->read(block, sizeof(block))) > 0) {
+        ret += QuotedPrintablePrivate::encodedBodySize(
+            block, int(in), formatter.maxLength(), chars);
+    }
+    return in < 0 ? -1 : ret;
+}
@@ -29,7 +29,7 @@ class MimePartPrivate;
 class SMTP_EXPORT MimePart
 {
 public:
-    enum Encoding { _7Bit, _8Bit, Base64, QuotedPrintable };
+    enum Encoding { _7Bit, _8Bit, Base64, QuotedPrintable, Binary };
 
     MimePart();
     MimePart(const MimePart &other);
@@ -72,6 +72,7 @@ protected:
     virtual bool writeData(QIODevice *device);
 
     QSharedDataPointer<MimePartPrivate> d_ptr;
+    friend class MimePartPrivate;
 
     // Q_DECLARE_PRIVATE equivalent for shared data pointers
     MimePartPrivate *d_func();
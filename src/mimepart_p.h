@@ -30,12 +30,46 @@ namespace SimpleMail {
 class MimePartPrivate : public QSharedData
 {
 public:
+    enum {
+        BlockSize       = 4096,
+        Base64BlockSize = 6000, // Must be multiple of 3
+    };
+
     virtual ~MimePartPrivate();
 
     bool writeRaw(QIODevice *input, QIODevice *out);
     bool writeBase64(QIODevice *input, QIODevice *out);
     bool writeQuotedPrintable(QIODevice *input, QIODevice *out);
 
+    /**
+     * Encodes a block wrapping it's lines into \p out, which keeps
+     * it's capacity so it can be reused for the next block.
+     */
+    static void encodeBase64(const char *data,
+                             int size,
+                             const MimeContentFormatter &formatter,
+                             QByteArray &out);
+    static void encodeQuotedPrintable(const char *data,
+                                      int size,
+                                      const MimeContentFormatter &formatter,
+                                      int &chars,
+                                      QByteArray &out);
+
+    /**
+     * Returns a copy of \p part and of the parts it contains with content
+     * devices of their own, files are opened again by name and other
+     * devices are read into a buffer, so the copy can be written on
+     * another thread while the original is in use.
+     */
+    static std::shared_ptr<MimePart> detachedCopy(const MimePart &part);
+
+    /**
+     * Return the exact size the encoders above produce for the content,
+     * without encoding it, -1 if the input can't be read.
+     */
+    static qint64 base64Size(qint64 size, const MimeContentFormatter &formatter);
+    static qint64 quotedPrintableSize(QIODevice *input, const MimeContentFormatter &formatter);
+
     QByteArray header;
     std::shared_ptr<QIODevice> contentDevice;
 
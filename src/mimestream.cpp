@@ -0,0 +1,315 @@
+/*
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  See the LICENSE file for more details.
+*/
+#include "mimestream_p.h"
+
+#include "mimepart_p.h"
+
+#include <cstring>
+
+using namespace SimpleMail;
+
+MimeStream::MimeStream()
+{
+    open(QIODevice::ReadWrite | QIODevice::Unbuffered);
+}
+
+MimeStream::~MimeStream() = default;
+
+void MimeStream::setBodyEncoding(BodyEncoding encoding)
+{
+    m_bodyEncoding = encoding;
+}
+
+MimeStream::BodyEncoding MimeStream::bodyEncoding() const
+{
+    return m_bodyEncoding;
+}
+
+MimePart::Encoding MimeStream::transferEncoding(QIODevice *device,
+                                                MimePart::Encoding encoding,
+                                                const QByteArray &contentType)
+{
+    switch (m_bodyEncoding) {
+    case SevenBit:
+        break;
+    case EightBitMime:
+        if (device && encoding == MimePart::QuotedPrintable &&
+            contentType.toLower().startsWith("text/")) {
+            auto it = m_transferEncodings.constFind(device);
+            if (it == m_transferEncodings.constEnd()) {
+                it = m_transferEncodings.insert(
+                    device, isEightBitText(device) ? MimePart::_8Bit : encoding);
+            }
+            return it.value();
+        }
+        break;
+    case BinaryMime:
+        if (encoding != MimePart::_7Bit) {
+            return MimePart::Binary;
+        }
+        break;
+    }
+    return encoding;
+}
+
+void MimeStream::appendContent(const std::shared_ptr<QIODevice> &device,
+                               MimePart::Encoding encoding,
+                               const QByteArray &contentType,
+                               const MimeContentFormatter &formatter)
+{
+    Segment segment;
+    segment.device        = device;
+    segment.encoding      = transferEncoding(device.get(), encoding, contentType);
+    segment.formatter     = formatter;
+    segment.canonicalText = encoding == MimePart::QuotedPrintable &&
+                            segment.encoding == MimePart::_8Bit;
+    m_segments.push_back(std::move(segment));
+}
+
+void MimeStream::appendMessage(const std::shared_ptr<QIODevice> &device)
+{
+    Segment segment;
+    segment.device = device;
+    m_segments.push_back(std::move(segment));
+}
+
+qint64 MimeStream::encodedSize()
+{
+    qint64 ret = 0;
+    for (const Segment &segment : m_segments) {
+        QIODevice *input = segment.device.get();
+        if (!input) {
+            ret += segment.literal.size();
+            continue;
+        }
+
+        if (input->isSequential() || (!input->isOpen() && !input->open(QIODevice::ReadOnly))) {
+            return -1;
+        }
+
+        qint64 size = -1;
+        switch (segment.encoding) {
+        case MimePart::_7Bit:
+        case MimePart::_8Bit:
+        case MimePart::Binary:
+            size = segment.canonicalText ? canonicalSize(input) : input->size();
+            break;
+        case MimePart::Base64:
+            size = MimePartPrivate::base64Size(input->size(), segment.formatter);
+            break;
+        case MimePart::QuotedPrintable:
+            size = MimePartPrivate::quotedPrintableSize(input, segment.formatter);
+            break;
+        }
+
+        if (size < 0) {
+            return -1;
+        }
+        ret += size;
+    }
+    return ret;
+}
+
+void MimeStream::rewind()
+{
+    m_pending.resize(0);
+    m_current    = 0;
+    m_pendingPos = 0;
+    m_started    = false;
+    m_error      = false;
+}
+
+bool MimeStream::isSequential() const
+{
+    return true;
+}
+
+qint64 MimeStream::readData(char *data, qint64 maxSize)
+{
+    qint64 total = 0;
+    while (total < maxSize) {
+        if (m_pendingPos == m_pending.size()) {
+            if (m_current == m_segments.size()) {
+                break;
+            }
+
+            if (!fill(m_segments[m_current])) {
+                if (m_error) {
+                    // Content device failed
+                    return -1;
+                }
+                ++m_current;
+                m_started = false;
+            }
+            continue;
+        }
+
+        const int size = int(qMin<qint64>(m_pending.size() - m_pendingPos, maxSize - total));
+        memcpy(data + total, m_pending.constData() + m_pendingPos, size_t(size));
+        m_pendingPos += size;
+        total += size;
+    }
+    return total;
+}
+
+qint64 MimeStream::writeData(const char *data, qint64 len)
+{
+    if (m_segments.empty() || m_segments.back().device) {
+        m_segments.emplace_back();
+    }
+    m_segments.back().literal.append(data, int(len));
+    return len;
+}
+
+bool MimeStream::fill(Segment &segment)
+{
+    // Keeps the capacity for the encoders
+    m_pending.resize(0);
+    m_pendingPos = 0;
+
+    if (!segment.device) {
+        if (m_started) {
+            return false;
+        }
+        m_started = true;
+        // Copied instead of shared, so the buffer isn't detached for the next block
+        m_pending.reserve(segment.literal.size());
+        m_pending.append(segment.literal.constData(), segment.literal.size());
+        return true;
+    }
+
+    if (!m_started) {
+        m_started     = true;
+        segment.pos    = 0;
+        segment.chars  = 0;
+        segment.lastCR = false;
+    }
+
+    // The device might be shared with other streams, so always seek to our position
+    QIODevice *input = segment.device.get();
+    if ((!input->isOpen() && !input->open(QIODevice::ReadOnly)) || !input->seek(segment.pos)) {
+        m_error = true;
+        return false;
+    }
+
+    char block[MimePartPrivate::Base64BlockSize];
+    const qint64 blockSize =
+        segment.encoding == MimePart::Base64 ? sizeof(block) : MimePartPrivate::BlockSize;
+    const qint64 in = input->read(block, blockSize);
+    if (in < 0) {
+        m_error = true;
+        return false;
+    } else if (in == 0) {
+        return false;
+    }
+    segment.pos += in;
+
+    switch (segment.encoding) {
+    case MimePart::_7Bit:
+    case MimePart::_8Bit:
+    case MimePart::Binary:
+        if (segment.canonicalText) {
+            canonicalize(segment, block, int(in), m_pending);
+        } else {
+            m_pending.reserve(int(in));
+            m_pending.append(block, int(in));
+        }
+        break;
+    case MimePart::Base64:
+        MimePartPrivate::encodeBase64(block, int(in), segment.formatter, m_pending);
+        break;
+    case MimePart::QuotedPrintable:
+        MimePartPrivate::encodeQuotedPrintable(
+            block, int(in), segment.formatter, segment.chars, m_pending);
+        break;
+    }
+    return true;
+}
+
+bool MimeStream::isEightBitText(QIODevice *device)
+{
+    if ((!device->isOpen() && !device->open(QIODevice::ReadOnly)) || !device->seek(0)) {
+        return false;
+    }
+
+    char block[MimePartPrivate::BlockSize];
+    int line = 0;
+    bool cr  = false;
+    qint64 in;
+    while ((in = device->read(block, sizeof(block))) > 0) {
+        for (qint64 i = 0; i < in; ++i) {
+            const char c = block[i];
+            if (c == '\0' || (cr && c != '\n')) {
+                // NUL and bare CR are not allowed in 8bit data
+                return false;
+            }
+
+            if (c == '\n') {
+                line = 0;
+                cr   = false;
+            } else {
+                cr = c == '\r';
+                // RFC 5322 line limit is 998 octets without the CRLF
+                if (!cr && ++line > 998) {
+                    return false;
+                }
+            }
+        }
+    }
+    return in == 0 && !cr;
+}
+
+qint64 MimeStream::canonicalSize(QIODevice *device)
+{
+    if (!device->seek(0)) {
+        return -1;
+    }
+
+    // Same as canonicalize() without building the output
+    char block[MimePartPrivate::BlockSize];
+    qint64 ret  = 0;
+    bool lastCR = false;
+    qint64 in;
+    while ((in = device->read(block, sizeof(block))) > 0) {
+        ret += in;
+        for (qint64 i = 0; i < in; ++i) {
+            const char c = block[i];
+            if (c == '\n' && !lastCR) {
+                ++ret;
+            }
+            lastCR = c == '\r';
+        }
+    }
+    return in < 0 ? -1 : ret;
+}
+
+void MimeStream::canonicalize(Segment &segment, const char *input, int size, QByteArray &out)
+{
+    // Text sent as 8bit must use CRLF line breaks, at worst every byte is a LF
+    out.reserve(size * 2);
+    out.resize(size * 2);
+    char *output = out.data();
+    for (int i = 0; i < size; ++i) {
+        const char c = input[i];
+        if (c == '\n' && !segment.lastCR) {
+            *output++ = '\r';
+        }
+        *output++ = c;
+
+        segment.lastCR = c == '\r';
+    }
+    out.resize(int(output - out.constData()));
+}
+
+#include "moc_mimestream_p.cpp"
@@ -0,0 +1,132 @@
+/*
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  See the LICENSE file for more details.
+*/
+#ifndef MIMESTREAM_P_H
+#define MIMESTREAM_P_H
+
+#include "mimecontentformatter.h"
+#include "mimepart.h"
+
+#include <memory>
+#include <vector>
+
+#include <QHash>
+#include <QIODevice>
+
+namespace SimpleMail {
+
+/**
+ * A sequential device that records a MimeMessage::write() call
+ * without encoding the parts content.
+ *
+ * Headers and boundaries are kept as written while the content of
+ * each part is only referenced, it's read and encoded block by block
+ * as the stream is read, so the memory used to send a message does
+ * not depend on the size of it's attachments.
+ */
+class MimeStream : public QIODevice
+{
+    Q_OBJECT
+public:
+    /**
+     * What the server accepts in the message body, this is negotiated
+     * with the BODY parameter of MAIL FROM.
+     */
+    enum BodyEncoding {
+        SevenBit,     // RFC 5321 default, everything is encoded
+        EightBitMime, // RFC 6152 text parts can be sent without encoding
+        BinaryMime,   // RFC 3030 all parts can be sent without encoding, requires BDAT
+    };
+
+    MimeStream();
+    ~MimeStream() override;
+
+    /**
+     * Must be set before the message is written into the stream
+     */
+    void setBodyEncoding(BodyEncoding encoding);
+    BodyEncoding bodyEncoding() const;
+
+    /**
+     * Returns the encoding a part with \p device content will be sent with,
+     * text parts are only sent as 8bit if their content is valid for it
+     * (no NUL and lines no longer than 998 octets), so the device might be
+     * scanned once, the result is cached for the parts writeData() call.
+     */
+    MimePart::Encoding transferEncoding(QIODevice *device,
+                                        MimePart::Encoding encoding,
+                                        const QByteArray &contentType);
+
+    /**
+     * Called by MimePart::writeData() instead of encoding the content
+     */
+    void appendContent(const std::shared_ptr<QIODevice> &device,
+                       MimePart::Encoding encoding,
+                       const QByteArray &contentType,
+                       const MimeContentFormatter &formatter);
+
+    /**
+     * Appends a message that was already rendered, it's sent as is
+     */
+    void appendMessage(const std::shared_ptr<QIODevice> &device);
+
+    /**
+     * Returns the exact number of bytes this stream will produce,
+     * computed from the content sizes without encoding them,
+     * or -1 if a sequential content device makes it unknown.
+     */
+    qint64 encodedSize();
+
+    /**
+     * Starts reading the stream from the beginning again, so the
+     * message is sent in several transactions without writing it again
+     */
+    void rewind();
+
+    bool isSequential() const override;
+
+protected:
+    qint64 readData(char *data, qint64 maxSize) override;
+    qint64 writeData(const char *data, qint64 len) override;
+
+private:
+    struct Segment {
+        QByteArray literal;
+        std::shared_ptr<QIODevice> device;
+        MimeContentFormatter formatter;
+        MimePart::Encoding encoding = MimePart::_7Bit;
+        qint64 pos                  = 0;
+        int chars                   = 0;
+        bool canonicalText          = false;
+        bool lastCR                 = false;
+    };
+
+    bool fill(Segment &segment);
+    static bool isEightBitText(QIODevice *device);
+    static qint64 canonicalSize(QIODevice *device);
+    static void canonicalize(Segment &segment, const char *input, int size, QByteArray &out);
+
+    std::vector<Segment> m_segments;
+    QHash<QIODevice *, MimePart::Encoding> m_transferEncodings;
+    // Reused for every block, it keeps it's capacity once large enough
+    QByteArray m_pending;
+    size_t m_current            = 0;
+    int m_pendingPos            = 0;
+    BodyEncoding m_bodyEncoding = SevenBit;
+    bool m_started              = false;
+    bool m_error                = false;
+};
+
+} // namespace SimpleMail
+
+#endif // MIMESTREAM_P_H
@@ -0,0 +1,90 @@
+/*
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  See the LICENSE file for more details.
+*/
+#ifndef MPSCQUEUE_P_H
+#define MPSCQUEUE_P_H
+
+#include <atomic>
+#include <utility>
+
+namespace SimpleMail {
+
+/**
+ * Unbounded lock-free multiple producers single consumer queue
+ * (Dmitry Vyukov's algorithm), push() may be called from any thread
+ * but pop() must only be called from the consumer thread.
+ *
+ * T must be default constructible and cheap to construct, it's
+ * meant to hold pointers.
+ */
+template <typename T>
+class MpscQueue
+{
+public:
+    MpscQueue()
+        : m_head(new Node)
+        , m_tail(m_head.load(std::memory_order_relaxed))
+    {
+    }
+
+    ~MpscQueue()
+    {
+        T value;
+        while (pop(value)) {
+        }
+        delete m_tail;
+    }
+
+    MpscQueue(const MpscQueue &)            = delete;
+    MpscQueue &operator=(const MpscQueue &) = delete;
+
+    void push(T &&value)
+    {
+        auto node   = new Node;
+        node->value = std::move(value);
+
+        Node *prev = m_head.exchange(node, std::memory_order_acq_rel);
+        prev->next.store(node, std::memory_order_release);
+    }
+
+    /**
+     * Returns false if the queue is empty, or if a producer is in
+     * the middle of a push(), in which case it will be visible soon.
+     */
+    bool pop(T &value)
+    {
+        Node *tail = m_tail;
+        Node *next = tail->next.load(std::memory_order_acquire);
+        if (!next) {
+            return false;
+        }
+
+        value  = std::move(next->value);
+        m_tail = next;
+        delete tail;
+        return true;
+    }
+
+private:
+    struct Node {
+        std::atomic<Node *> next{nullptr};
+        T value{};
+    };
+
+    std::atomic<Node *> m_head;
+    Node *m_tail;
+};
+
+} // namespace SimpleMail
+
+#endif // MPSCQUEUE_P_H
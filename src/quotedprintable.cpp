@@ -15,103 +15,307 @@
   See the LICENSE file for more details.
 */
 
-#include "quotedprintable.h"
+#include "quotedprintable_p.h"
+
+#include <cstring>
+#include <limits>
+
+#include <QIODevice>
 
 using namespace SimpleMail;
 
-// ASCII character values used throughout
-const unsigned char MinPrintableRange = 0x20;
-const unsigned char MaxPrintableRange = 0x7e;
-const unsigned char HorizontalTab     = 0x09;
-// const unsigned char LineFeed = 0x0a;
-const unsigned char FormFeed = 0x0c;
-// const unsigned char CarriageReturn = 0x0d;
-const unsigned char Space           = 0x20;
-const unsigned char Equals          = 0x3d;
-const unsigned char ExclamationMark = 0x21;
-const unsigned char Asterisk        = 0x2a;
-const unsigned char Plus            = 0x2b;
-const unsigned char Minus           = 0x2d;
-const unsigned char Slash           = 0x2f;
-const unsigned char Underscore      = 0x5f;
-
-static inline bool requiresEscape(unsigned char input, bool rfc2047)
+namespace {
+
+constexpr bool isAlphaNumeric(int c)
 {
-    // For both, we need to escape '=' and anything unprintable
-    bool escape =
-        ((input > MaxPrintableRange) ||
-         ((input < MinPrintableRange) && (input != HorizontalTab) && (input != FormFeed)) ||
-         (input == Equals));
-
-    // For RFC 2047, we need to escape '?', '_', ' ' & '\t'
-    // In fact, since the output may be used in a header field 'word', then the only characters
-    // that can be used un-escaped are: alphanumerics, '!', '*', '+' '-', '/' and '_'
-    if (!escape && rfc2047) {
-        // We can also ignore space, since it will become an underscore
-        if ((input != ExclamationMark) && (input != Asterisk) && (input != Plus) &&
-            (input != Minus) && (input != Slash) && (input != Underscore) && (input != Space)) {
-            escape = !isalnum(input);
-        }
+    return (c >= '0' && c <= '9') || (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z');
+}
+
+struct EscapeTable {
+    bool body[256];
+    bool header[256];
+};
+
+constexpr EscapeTable makeEscapeTable()
+{
+    EscapeTable table{};
+    for (int c = 0; c < 256; ++c) {
+        // For both, we need to escape '=' and anything unprintable
+        table.body[c] = c > 0x7e || (c < 0x20 && c != '\t' && c != '\f') || c == '=';
+
+        // For RFC 2047, since the output may be used in a header field 'word', the only
+        // characters that can be used un-escaped are: alphanumerics, '!', '*', '+' '-', '/'
+        // and '_', space is also kept since it will become an underscore
+        table.header[c] = table.body[c] || !(isAlphaNumeric(c) || c == '!' || c == '*' ||
+                                             c == '+' || c == '-' || c == '/' || c == '_' ||
+                                             c == ' ');
     }
+    return table;
+}
+
+constexpr EscapeTable Escape = makeEscapeTable();
+
+const char Hex[] = "0123456789ABCDEF";
 
-    return escape;
+struct HexTable {
+    signed char value[256];
+};
+
+constexpr HexTable makeHexTable()
+{
+    HexTable table{};
+    for (int c = 0; c < 256; ++c) {
+        if (c >= '0' && c <= '9') {
+            table.value[c] = static_cast<signed char>(c - '0');
+        } else if (c >= 'A' && c <= 'F') {
+            table.value[c] = static_cast<signed char>(c - 'A' + 10);
+        } else if (c >= 'a' && c <= 'f') {
+            table.value[c] = static_cast<signed char>(c - 'a' + 10);
+        } else {
+            table.value[c] = -1;
+        }
+    }
+    return table;
 }
 
-QByteArray
-    QuotedPrintable::encode(const QByteArray &input, bool rfc2047, int *printable, int *encoded)
+constexpr HexTable HexValue = makeHexTable();
+
+// True if none of the 8 bytes needs to be escaped in a body,
+// tab and form feed are reported as escaped, the caller checks them one by one
+inline bool isPlainWord(quint64 word)
 {
-    QByteArray output;
+    const quint64 ones  = Q_UINT64_C(0x0101010101010101);
+    const quint64 highs = Q_UINT64_C(0x8080808080808080);
+
+    const quint64 control = (word - ones * 0x20) & ~word & highs;
+    const quint64 high    = ((word + ones * (0x7f - 0x7e)) | word) & highs;
+    const quint64 equals  = word ^ (ones * '=');
+    return !(control | high | ((equals - ones) & ~equals & highs));
+}
+
+// Writes the encoded body, the caller reserved enough room
+struct WritingSink {
+    char *output;
+
+    inline void softBreak()
+    {
+        memcpy(output, "=\r\n", 3);
+        output += 3;
+    }
+    inline void put(char c) { *output++ = c; }
+    inline void copy(const quint8 *data, int count)
+    {
+        memcpy(output, data, size_t(count));
+        output += count;
+    }
+};
 
-    quint8 byte;
-    static const char hex[] = {
-        '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'A', 'B', 'C', 'D', 'E', 'F'};
+// Counts what WritingSink would write
+struct CountingSink {
+    qint64 size = 0;
 
-    for (int i = 0; i < input.length(); ++i) {
-        byte = quint8(input[i]);
+    inline void softBreak() { size += 3; }
+    inline void put(char) { ++size; }
+    inline void copy(const quint8 *, int count) { size += count; }
+};
 
-        if (requiresEscape(byte, rfc2047)) {
-            output.append('=');
-            output.append(hex[((byte >> 4) & 0x0F)]);
-            output.append(hex[(byte & 0x0F)]);
-            if (encoded) {
-                ++(*encoded);
+// Encodes a block of body content starting at \p column, returns the column it ends on
+template <typename Sink>
+int encodeBlock(const quint8 *in, const quint8 *end, int lineLength, int column, Sink &sink)
+{
+    // A character that would go past the last column moves to a new line,
+    // an escape sequence is never split
+    const auto put = [&](char c, int reserve) {
+        ++column;
+        if (column > lineLength - reserve) {
+            sink.softBreak();
+            column = 1;
+        }
+        sink.put(c);
+    };
+
+    while (in < end) {
+        const quint8 byte = *in;
+        const int room    = lineLength - 1 - column;
+        if (!Escape.body[byte] && room > 0) {
+            // Copies the run of plain characters that fits on the line
+            const quint8 *runEnd = in + qMin<qint64>(room, end - in);
+            const quint8 *run    = in;
+            quint64 word;
+            while (runEnd - run >= 8 && (memcpy(&word, run, 8), isPlainWord(word))) {
+                run += 8;
             }
-        } else {
-            output.append(char(byte));
-            if (printable) {
-                ++(*printable);
+            while (run < runEnd && !Escape.body[*run]) {
+                ++run;
             }
+
+            const int count = int(run - in);
+            sink.copy(in, count);
+            column += count;
+            in = run;
+            continue;
         }
+
+        if (Escape.body[byte]) {
+            put('=', 3);
+            put(Hex[byte >> 4], 1);
+            put(Hex[byte & 0x0F], 1);
+        } else {
+            put(char(byte), 1);
+        }
+        ++in;
     }
+    return column;
+}
 
+} // namespace
+
+QByteArray
+    QuotedPrintable::encode(const QByteArray &input, bool rfc2047, int *printable, int *encoded)
+{
+    const bool *escape = rfc2047 ? Escape.header : Escape.body;
+
+    QByteArray output(input.size() * 3, Qt::Uninitialized);
+    char *out   = output.data();
+    int escaped   = 0;
+    for (const char c : input) {
+        const auto byte = quint8(c);
+        if (escape[byte]) {
+            out[0] = '=';
+            out[1] = Hex[byte >> 4];
+            out[2] = Hex[byte & 0x0F];
+            out += 3;
+            ++escaped;
+        } else {
+            *out++ = c;
+        }
+    }
+    output.resize(int(out - output.constData()));
+
+    if (encoded) {
+        *encoded += escaped;
+    }
+    if (printable) {
+        *printable += input.size() - escaped;
+    }
     return output;
 }
 
+void QuotedPrintablePrivate::encodeBody(const char *data,
+                                        int size,
+                                        int lineLength,
+                                        int &chars,
+                                        QByteArray &out)
+{
+    // Every line but the last ends with a soft break preceded by at least
+    // lineLength - 3 characters
+    const int payload = size * 3;
+    const int bound   = payload + 4 * (payload / qMax(1, lineLength - 3) + 2);
+    out.reserve(bound);
+    out.resize(bound);
+
+    const auto *in = reinterpret_cast<const quint8 *>(data);
+    WritingSink sink{out.data()};
+    chars = encodeBlock(in, in + size, lineLength, chars, sink);
+    out.resize(int(sink.output - out.constData()));
+}
+
+qint64 QuotedPrintablePrivate::encodedBodySize(const char *data,
+                                               int size,
+                                               int lineLength,
+                                               int &chars)
+{
+    const auto *in = reinterpret_cast<const quint8 *>(data);
+    CountingSink sink;
+    chars = encodeBlock(in, in + size, lineLength, chars, sink);
+    return sink.size;
+}
+
 QByteArray QuotedPrintable::decode(const QByteArray &input)
 {
-    //                           0  1  2  3  4  5  6  7  8  9  :  ;  <  =  >  ?  @  A   B   C   D E
-    //                           F
-    static const int hexVal[] = {0, 1, 2, 3, 4, 5,  6,  7,  8,  9,  0, 0,
-                                 0, 0, 0, 0, 0, 10, 11, 12, 13, 14, 15};
+    // Decoded data is never longer, so a copy of the input is decoded in place
+    QByteArray output(input.constData(), input.size());
+    int consumed;
+    const int decoded =
+        QuotedPrintablePrivate::decodeInPlace(output.data(), output.size(), true, consumed);
+    output.resize(decoded);
+    return output;
+}
 
-    QByteArray output;
+int QuotedPrintablePrivate::decodeInPlace(char *data, int size, bool last, int &consumed)
+{
+    const char *in  = data;
+    const char *end = data + size;
+    char *out       = data;
+    while (in < end) {
+        const auto *equals = static_cast<const char *>(memchr(in, '=', size_t(end - in)));
+        const char *runEnd = equals ? equals : end;
+        if (out != in) {
+            memmove(out, in, size_t(runEnd - in));
+        }
+        out += runEnd - in;
+        in = runEnd;
+        if (!equals) {
+            break;
+        }
 
-    int len = input.length();
-    for (int i = 0; i < len - 2; ++i) {
-        if (input.at(i) == '=') {
-            int x = input.at(i + 1) - '0';
-            int y = input.at(i + 2) - '0';
-            if (x >= 0 && y >= 0 && x < 23 && y < 23) {
-                output.append(char((hexVal[x] << 4) + hexVal[y]));
-            } else {
-                output.append('=').append(char(x + '0')).append(char(y + '0'));
-            }
+        const qint64 left = end - equals;
+        const int high    = left >= 2 ? HexValue.value[quint8(equals[1])] : -1;
+        const int low     = left >= 3 ? HexValue.value[quint8(equals[2])] : -1;
+        if (high >= 0 && low >= 0) {
+            *out++ = char(high << 4 | low);
+            in += 3;
+            continue;
+        }
 
-            i += 2;
+        // A soft line break, encoders might leave whitespace before it
+        const char *next = equals + 1;
+        while (next < end && (*next == ' ' || *next == '\t')) {
+            ++next;
+        }
+        if (next < end && *next == '\n') {
+            in = next + 1;
+        } else if (end - next >= 2 && next[0] == '\r' && next[1] == '\n') {
+            in = next + 2;
+        } else if (!last && (next == end || (*next == '\r' && end - next == 1) ||
+                             (left == 2 && high >= 0))) {
+            // Cut by the end of the chunk, it's decoded with the next one
+            break;
         } else {
-            output.append(input.at(i));
+            // Not an escape, kept as is
+            *out++ = '=';
+            ++in;
         }
     }
 
+    consumed = int(in - data);
+    return int(out - data);
+}
+
+QByteArray QuotedPrintablePrivate::decode(QIODevice *input)
+{
+    QByteArray output;
+    output.reserve(int(qMin<qint64>(input->bytesAvailable(), std::numeric_limits<int>::max())));
+
+    // The chunks are read right after the decoded data, the start of an
+    // escape left by the previous one stays in between
+    int written = 0;
+    int pending = 0;
+    bool last   = false;
+    while (!last) {
+        output.resize(written + pending + DecodeBlockSize);
+        char *chunk     = output.data() + written;
+        const qint64 in = input->read(chunk + pending, DecodeBlockSize);
+        last            = in <= 0;
+
+        const int available = pending + int(qMax<qint64>(in, 0));
+        int consumed;
+        const int decoded = decodeInPlace(chunk, available, last, consumed);
+        pending           = available - consumed;
+        memmove(chunk + decoded, chunk + consumed, size_t(pending));
+        written += decoded;
+    }
+
+    output.resize(written);
     return output;
 }
@@ -0,0 +1,64 @@
+/*
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  See the LICENSE file for more details.
+*/
+#ifndef QUOTEDPRINTABLE_P_H
+#define QUOTEDPRINTABLE_P_H
+
+#include "quotedprintable.h"
+
+class QIODevice;
+
+namespace SimpleMail {
+
+class QuotedPrintablePrivate
+{
+public:
+    enum {
+        DecodeBlockSize = 16 * 1024,
+    };
+
+    /**
+     * Encodes a block of body content into \p out in a single pass,
+     * breaking lines at \p lineLength with soft line breaks. \p chars
+     * carries the position on the current line from one block to the next.
+     *
+     * Produces the same as QuotedPrintable::encode() followed by
+     * MimeContentFormatter::formatQuotedPrintable() without dot-stuffing,
+     * \p out keeps its capacity so it can be reused for the next block.
+     */
+    static void
+        encodeBody(const char *data, int size, int lineLength, int &chars, QByteArray &out);
+
+    /**
+     * Returns the size encodeBody() produces for the block without
+     * encoding it, \p chars is updated the same way.
+     */
+    static qint64 encodedBodySize(const char *data, int size, int lineLength, int &chars);
+
+    /**
+     * Decodes the \p size bytes at \p data in place and returns the
+     * decoded size, \p consumed is set to the number of input bytes used.
+     * Unless it's the \p last chunk an escape or soft line break cut by
+     * the end is left for the next call, invalid escapes are kept as is.
+     */
+    static int decodeInPlace(char *data, int size, bool last, int &consumed);
+
+    /**
+     * Reads \p input to it's end decoding it chunk by chunk
+     */
+    static QByteArray decode(QIODevice *input);
+};
+
+} // namespace SimpleMail
+
+#endif // QUOTEDPRINTABLE_P_H
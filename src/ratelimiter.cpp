@@ -0,0 +1,85 @@
+/*
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  See the LICENSE file for more details.
+*/
+#include "ratelimiter_p.h"
+
+#include <cmath>
+
+#include <QtGlobal>
+
+using namespace SimpleMail;
+
+void TokenBucket::setRate(double perSecond)
+{
+    m_rate   = qMax(0.0, perSecond);
+    m_tokens = qMax(1.0, m_rate);
+}
+
+qint64 TokenBucket::delay(qint64 now)
+{
+    if (m_rate <= 0) {
+        return 0;
+    }
+
+    refill(now);
+    if (m_tokens >= 1) {
+        return 0;
+    }
+    return qint64(std::ceil((1 - m_tokens) * 1000 / m_rate));
+}
+
+void TokenBucket::consume(double amount, qint64 now)
+{
+    if (m_rate <= 0) {
+        return;
+    }
+
+    refill(now);
+    m_tokens -= amount;
+}
+
+void TokenBucket::refill(qint64 now)
+{
+    // One second worth of tokens, but at least one so slow rates still send
+    const double burst = qMax(1.0, m_rate);
+    m_tokens           = qMin(burst, m_tokens + (now - m_last) * m_rate / 1000);
+    m_last             = now;
+}
+
+RateLimiter::RateLimiter()
+{
+    m_clock.start();
+}
+
+qint64 RateLimiter::transactionDelay()
+{
+    const qint64 now = m_clock.elapsed();
+    return qMax(qMax(messages.delay(now), recipients.delay(now)), bytes.delay(now));
+}
+
+qint64 RateLimiter::dataDelay()
+{
+    return bytes.delay(m_clock.elapsed());
+}
+
+void RateLimiter::startTransaction(int recipientCount)
+{
+    const qint64 now = m_clock.elapsed();
+    messages.consume(1, now);
+    recipients.consume(recipientCount, now);
+}
+
+void RateLimiter::consumeData(qint64 count)
+{
+    bytes.consume(double(count), m_clock.elapsed());
+}
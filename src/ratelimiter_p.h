@@ -0,0 +1,86 @@
+/*
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  See the LICENSE file for more details.
+*/
+#ifndef RATELIMITER_P_H
+#define RATELIMITER_P_H
+
+#include <QElapsedTimer>
+
+namespace SimpleMail {
+
+/**
+ * Token bucket refilled at a constant rate, holding up to one
+ * second worth of tokens.
+ *
+ * Consuming more tokens than available is allowed, so a single
+ * message larger than the burst still goes out, the debt then
+ * delays whatever comes next.
+ */
+class TokenBucket
+{
+public:
+    /**
+     * Defines the tokens added per second, 0 disables the limit
+     */
+    void setRate(double perSecond);
+    inline double rate() const { return m_rate; }
+
+    /**
+     * Returns the milliseconds until a whole token is available, 0 if it is
+     */
+    qint64 delay(qint64 now);
+
+    void consume(double amount, qint64 now);
+
+private:
+    void refill(qint64 now);
+
+    double m_rate   = 0;
+    double m_tokens = 0;
+    qint64 m_last   = 0;
+};
+
+/**
+ * Paces the transactions of one Server, or all the servers of
+ * a ServerPool sharing it, in messages, recipients and bytes
+ * per second.
+ */
+class RateLimiter
+{
+public:
+    RateLimiter();
+
+    /**
+     * Returns the milliseconds until a new transaction may start
+     */
+    qint64 transactionDelay();
+
+    /**
+     * Returns the milliseconds until more data may be written
+     */
+    qint64 dataDelay();
+
+    void startTransaction(int recipientCount);
+    void consumeData(qint64 count);
+
+    TokenBucket messages;
+    TokenBucket recipients;
+    TokenBucket bytes;
+
+private:
+    QElapsedTimer m_clock;
+};
+
+} // namespace SimpleMail
+
+#endif // RATELIMITER_P_H
@@ -0,0 +1,162 @@
+/*
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  See the LICENSE file for more details.
+*/
+#include "replyparser_p.h"
+
+#include <cstring>
+
+#include <QIODevice>
+
+using namespace SimpleMail;
+
+static inline bool isSpace(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '\v' || c == '\f';
+}
+
+static inline bool isDigit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+void ReplyParser::feed(QIODevice *device)
+{
+    const qint64 available = device->bytesAvailable();
+    if (available <= 0) {
+        return;
+    }
+
+    // Only an incomplete reply is left at this point, so this moves a few bytes
+    if (m_begin > 0) {
+        memmove(m_buffer.data(), m_buffer.constData() + m_begin, size_t(m_end - m_begin));
+        m_end -= m_begin;
+        m_begin = 0;
+    }
+
+    if (m_buffer.size() < m_end + available) {
+        m_buffer.resize(int(m_end + available));
+    }
+
+    const qint64 read = device->read(m_buffer.data() + m_end, available);
+    if (read > 0) {
+        m_end += int(read);
+    }
+}
+
+void ReplyParser::clear()
+{
+    m_lines.clear();
+    m_begin = 0;
+    m_end   = 0;
+    m_code  = 0;
+}
+
+bool ReplyParser::next()
+{
+    const char *data = m_buffer.constData();
+
+    m_lines.clear();
+    int pos = m_begin;
+    while (pos < m_end) {
+        const auto newLine =
+            static_cast<const char *>(memchr(data + pos, '\n', size_t(m_end - pos)));
+        if (!newLine) {
+            break;
+        }
+        const int next = int(newLine - data) + 1;
+
+        // Same as QByteArray::trimmed()
+        int begin = pos;
+        int end   = next;
+        while (begin < end && isSpace(data[begin])) {
+            ++begin;
+        }
+        while (end > begin && isSpace(data[end - 1])) {
+            --end;
+        }
+        pos = next;
+        m_lines.append(Line{begin, end - begin});
+
+        // "250-" continues the reply, "250 " or a bare "250" ends it
+        if (end - begin < 4 || data[begin + 3] != '-') {
+            m_code = 0;
+            if (end - begin >= 3 && isDigit(data[begin]) && isDigit(data[begin + 1]) &&
+                isDigit(data[begin + 2])) {
+                m_code = (data[begin] - '0') * 100 + (data[begin + 1] - '0') * 10 +
+                         (data[begin + 2] - '0');
+            }
+            m_begin = pos;
+            return true;
+        }
+    }
+
+    // Incomplete, the lines will be scanned again once more data arrives
+    m_lines.clear();
+    return false;
+}
+
+QLatin1String ReplyParser::enhancedStatus() const
+{
+    // class "." subject "." detail, RFC 3463
+    const QLatin1String status = text();
+    const char *data           = status.data();
+    const int size             = status.size();
+    if (size < 5 || (data[0] != '2' && data[0] != '4' && data[0] != '5') || data[1] != '.') {
+        return {};
+    }
+
+    int pos = 2;
+    for (int part = 0; part < 2; ++part) {
+        const int start = pos;
+        while (pos < size && isDigit(data[pos])) {
+            ++pos;
+        }
+        if (pos == start || pos - start > 3) {
+            return {};
+        }
+        if (part == 0) {
+            if (pos == size || data[pos] != '.') {
+                return {};
+            }
+            ++pos;
+        }
+    }
+
+    if (pos < size && data[pos] != ' ') {
+        return {};
+    }
+    return QLatin1String(data, pos);
+}
+
+QLatin1String ReplyParser::text() const
+{
+    if (m_lines.isEmpty()) {
+        return {};
+    }
+
+    const Line &last = m_lines.last();
+    if (last.size <= 4) {
+        return {};
+    }
+    return QLatin1String(m_buffer.constData() + last.begin + 4, last.size - 4);
+}
+
+QLatin1String ReplyParser::line(int index) const
+{
+    if (index < 0 || index >= m_lines.size()) {
+        return {};
+    }
+
+    const Line &line = m_lines.at(index);
+    return QLatin1String(m_buffer.constData() + line.begin, line.size);
+}
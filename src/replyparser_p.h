@@ -0,0 +1,91 @@
+/*
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  See the LICENSE file for more details.
+*/
+#ifndef REPLYPARSER_P_H
+#define REPLYPARSER_P_H
+
+#include <QByteArray>
+#include <QString>
+#include <QVarLengthArray>
+
+class QIODevice;
+
+namespace SimpleMail {
+
+/**
+ * Incremental SMTP reply tokenizer.
+ *
+ * Socket data is appended to a buffer that is reused for the whole
+ * connection, next() then scans it in place for a complete reply,
+ * joining multi-line "250-" continuations, so parsing a batch of
+ * pipelined replies doesn't allocate.
+ *
+ * The views returned are only valid until the next feed() or clear().
+ */
+class ReplyParser
+{
+public:
+    /**
+     * Appends all data available on \p device to the buffer
+     */
+    void feed(QIODevice *device);
+
+    /**
+     * Drops buffered data, like what was received before STARTTLS
+     */
+    void clear();
+
+    /**
+     * Parses the next complete reply, returns false if more data is needed
+     */
+    bool next();
+
+    /**
+     * Returns the reply code of the last line, 0 if it's not a number
+     */
+    inline int code() const { return m_code; }
+
+    /**
+     * Returns the RFC 3463 enhanced status code of the last line, like 5.1.1
+     * or an empty view if the server didn't send one
+     */
+    QLatin1String enhancedStatus() const;
+
+    /**
+     * Returns the last line text without the reply code
+     */
+    QLatin1String text() const;
+
+    /**
+     * Returns the full lines of the reply, including the reply code
+     */
+    inline int lineCount() const { return int(m_lines.size()); }
+    QLatin1String line(int index) const;
+    inline QLatin1String lastLine() const { return line(lineCount() - 1); }
+
+private:
+    struct Line {
+        int begin;
+        int size;
+    };
+
+    QByteArray m_buffer;
+    QVarLengthArray<Line, 32> m_lines;
+    int m_begin = 0;
+    int m_end   = 0;
+    int m_code  = 0;
+};
+
+} // namespace SimpleMail
+
+#endif // REPLYPARSER_P_H
@@ -0,0 +1,213 @@
+/*
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  See the LICENSE file for more details.
+*/
+#ifndef RINGBUFFER_P_H
+#define RINGBUFFER_P_H
+
+#include <new>
+#include <utility>
+
+#include <QtGlobal>
+
+namespace SimpleMail {
+
+/**
+ * Growable ring buffer of move-only values.
+ *
+ * Appending and removing from the front are O(1) and never move the
+ * other elements, the capacity is a power of two that doubles when
+ * full. Inserting or removing in the middle moves the elements between
+ * that position and the closer end, so it's cheap close to the front
+ * where the send queue does it.
+ */
+template <typename T>
+class RingBuffer
+{
+public:
+    class iterator
+    {
+    public:
+        inline iterator(RingBuffer *buffer, int index)
+            : m_buffer(buffer)
+            , m_index(index)
+        {
+        }
+
+        inline T &operator*() const { return (*m_buffer)[m_index]; }
+        inline T *operator->() const { return &(*m_buffer)[m_index]; }
+        inline iterator &operator++()
+        {
+            ++m_index;
+            return *this;
+        }
+        inline bool operator!=(const iterator &other) const { return m_index != other.m_index; }
+
+    private:
+        RingBuffer *m_buffer;
+        int m_index;
+    };
+
+    RingBuffer() = default;
+    RingBuffer(const RingBuffer &)            = delete;
+    RingBuffer &operator=(const RingBuffer &) = delete;
+
+    ~RingBuffer()
+    {
+        clear();
+        ::operator delete(m_data);
+    }
+
+    inline int size() const { return m_size; }
+    inline bool isEmpty() const { return m_size == 0; }
+    inline int capacity() const { return m_capacity; }
+
+    inline T &operator[](int index) { return m_data[slot(index)]; }
+    inline const T &operator[](int index) const { return m_data[slot(index)]; }
+    inline T &first() { return m_data[m_head]; }
+
+    inline iterator begin() { return iterator(this, 0); }
+    inline iterator end() { return iterator(this, m_size); }
+
+    void append(T &&value)
+    {
+        reserve(m_size + 1);
+        new (m_data + slot(m_size)) T(std::move(value));
+        ++m_size;
+    }
+
+    void insert(int index, T &&value)
+    {
+        if (index >= m_size) {
+            append(std::move(value));
+            return;
+        }
+
+        reserve(m_size + 1);
+        if (index < m_size / 2) {
+            // The first element moves to the free slot before the head
+            m_head = slot(m_capacity - 1);
+            if (index == 0) {
+                new (m_data + m_head) T(std::move(value));
+            } else {
+                new (m_data + m_head) T(std::move((*this)[1]));
+                for (int i = 1; i < index; ++i) {
+                    (*this)[i] = std::move((*this)[i + 1]);
+                }
+                (*this)[index] = std::move(value);
+            }
+            ++m_size;
+            return;
+        }
+
+        // The last element moves to the free slot, the others shift by one
+        new (m_data + slot(m_size)) T(std::move((*this)[m_size - 1]));
+        for (int i = m_size - 1; i > index; --i) {
+            (*this)[i] = std::move((*this)[i - 1]);
+        }
+        (*this)[index] = std::move(value);
+        ++m_size;
+    }
+
+    void removeFirst()
+    {
+        m_data[m_head].~T();
+        m_head = slot(1);
+        --m_size;
+    }
+
+    void removeAt(int index)
+    {
+        if (index < m_size / 2) {
+            // The elements before it shift towards the back
+            for (int i = index; i > 0; --i) {
+                (*this)[i] = std::move((*this)[i - 1]);
+            }
+            removeFirst();
+            return;
+        }
+
+        for (int i = index; i < m_size - 1; ++i) {
+            (*this)[i] = std::move((*this)[i + 1]);
+        }
+        (*this)[m_size - 1].~T();
+        --m_size;
+    }
+
+    T takeFirst()
+    {
+        T ret(std::move(first()));
+        removeFirst();
+        return ret;
+    }
+
+    T takeAt(int index)
+    {
+        T ret(std::move((*this)[index]));
+        removeAt(index);
+        return ret;
+    }
+
+    void clear()
+    {
+        while (m_size > 0) {
+            removeFirst();
+        }
+        m_head = 0;
+    }
+
+    void swap(RingBuffer &other) noexcept
+    {
+        std::swap(m_data, other.m_data);
+        std::swap(m_head, other.m_head);
+        std::swap(m_size, other.m_size);
+        std::swap(m_capacity, other.m_capacity);
+    }
+
+    void reserve(int size)
+    {
+        if (size <= m_capacity) {
+            return;
+        }
+
+        int capacity = qMax(m_capacity * 2, int(MinCapacity));
+        while (capacity < size) {
+            capacity *= 2;
+        }
+
+        T *data = static_cast<T *>(::operator new(sizeof(T) * size_t(capacity)));
+        for (int i = 0; i < m_size; ++i) {
+            T &value = (*this)[i];
+            new (data + i) T(std::move(value));
+            value.~T();
+        }
+        ::operator delete(m_data);
+
+        m_data     = data;
+        m_head     = 0;
+        m_capacity = capacity;
+    }
+
+private:
+    enum { MinCapacity = 8 };
+
+    inline int slot(int index) const { return (m_head + index) & (m_capacity - 1); }
+
+    T *m_data      = nullptr;
+    int m_head     = 0;
+    int m_size     = 0;
+    int m_capacity = 0;
+};
+
+} // namespace SimpleMail
+
+#endif // RINGBUFFER_P_H
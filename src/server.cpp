@@ -13,19 +13,45 @@
 
   See the LICENSE file for more details.
 */
+#include "mimestream_p.h"
 #include "server_p.h"
 #include "serverreply.h"
 
+#include <QDateTime>
+#include <QHash>
 #include <QHostInfo>
 #include <QLoggingCategory>
 #include <QMessageAuthenticationCode>
+#include <QMutex>
+#include <QRandomGenerator>
 #include <QSslSocket>
 #include <QTcpSocket>
+#include <QTimer>
 
 Q_LOGGING_CATEGORY(SIMPLEMAIL_SERVER, "simplemail.server", QtInfoMsg)
 
 using namespace SimpleMail;
 
+namespace {
+struct AuthMethodCache {
+    QMutex mutex;
+    QHash<QString, Server::AuthMethod> methods;
+};
+
+struct TlsSessionCache {
+    QMutex mutex;
+    QHash<QString, QByteArray> tickets;
+};
+} // namespace
+
+// Shared by all servers, and their threads, so reconnects skip the selection
+Q_GLOBAL_STATIC(AuthMethodCache, authMethodCache)
+
+#ifndef QT_NO_SSL
+// Session tickets by host and TLS setup, any new socket with the same key offers it
+Q_GLOBAL_STATIC(TlsSessionCache, tlsSessionCache)
+#endif
+
 Server::Server(QObject *parent)
     : QObject(parent)
     , d_ptr(new ServerPrivate(this))
@@ -128,35 +154,326 @@ void Server::setAuthMethod(Server::AuthMethod method)
     d->authMethod = method;
 }
 
+ServerCapabilities Server::capabilities() const
+{
+    Q_D(const Server);
+    return d->capabilities;
+}
+
+bool Server::bodyEncodingNegotiation() const
+{
+    Q_D(const Server);
+    return d->bodyEncodingNegotiation;
+}
+
+void Server::setBodyEncodingNegotiation(bool enable)
+{
+    Q_D(Server);
+    d->bodyEncodingNegotiation = enable;
+}
+
+bool Server::messagePipelining() const
+{
+    Q_D(const Server);
+    return d->messagePipelining;
+}
+
+void Server::setMessagePipelining(bool enable)
+{
+    Q_D(Server);
+    d->messagePipelining = enable;
+}
+
 ServerReply *Server::sendMail(const MimeMessage &email)
+{
+    return sendMail(email, SendOptions());
+}
+
+ServerReply *Server::sendMail(const MimeMessage &email, const SendOptions &options)
+{
+    Q_D(Server);
+    ServerReplyContainer cont(email, options);
+    cont.reply         = new ServerReply(this);
+    ServerReply *reply = cont.reply;
+
+    if (d->spool) {
+        ServerPrivate::listRecipients(cont);
+        QStringList recipients;
+        for (const ServerReply::RecipientStatus &status : qAsConst(cont.recipients)) {
+            recipients << status.address;
+        }
+
+        // The deadline is monotonic, the spool needs one that survives a restart
+        const qint64 expiry =
+            options.expiry.isForever()
+                ? 0
+                : QDateTime::currentMSecsSinceEpoch() + options.expiry.remainingTime();
+        const Spool::Entry entry = d->spool->enqueue(email, recipients, cont.priority, expiry);
+        if (entry.id) {
+            // Sent from the spool, so it's rendered once and what was kept is what's delivered
+            cont.spoolId = entry.id;
+            cont.spooled = d->spool->message(entry);
+        } else {
+            qCWarning(SIMPLEMAIL_SERVER) << "Failed to spool mail, it's only kept in memory";
+        }
+    }
+
+    // Add to the mail queue, behind the ones of the same priority
+    d->lanes[cont.priority].append(std::move(cont));
+    d->startQueue();
+
+    return reply;
+}
+
+QString Server::spoolDirectory() const
+{
+    Q_D(const Server);
+    return d->spool ? d->spool->path() : QString();
+}
+
+bool Server::setSpoolDirectory(const QString &path)
+{
+    Q_D(Server);
+    if (path.isEmpty()) {
+        d->spool.reset();
+        return true;
+    }
+
+    auto spool = std::make_unique<Spool>();
+    if (!spool->open(path)) {
+        return false;
+    }
+    d->spool = std::move(spool);
+    return true;
+}
+
+QList<ServerReply *> Server::resumeSpool()
 {
     Q_D(Server);
-    ServerReplyContainer cont(email);
-    cont.reply = new ServerReply(this);
 
-    // Add to the mail queue
-    d->queue.append(cont);
+    QList<ServerReply *> ret;
+    if (!d->spool) {
+        return ret;
+    }
+
+    const qint64 now = QDateTime::currentMSecsSinceEpoch();
+    for (const Spool::Entry &entry : d->spool->takeRecovered()) {
+        if (entry.inFlight) {
+            qCWarning(SIMPLEMAIL_SERVER)
+                << "Resuming mail" << entry.id << "that might have been delivered already";
+        }
+
+        SendOptions options;
+        options.priority = Priority(qBound(0, entry.priority, ServerPrivate::PriorityCount - 1));
+        if (entry.expiry > 0) {
+            // A negative time would never expire
+            options.expiry = QDeadlineTimer(qMax<qint64>(0, entry.expiry - now));
+        }
+
+        MimeMessage msg(false);
+        msg.setSender(EmailAddress(entry.sender, QString()));
+
+        ServerReplyContainer cont(msg, options);
+        cont.reply   = new ServerReply(this);
+        cont.spoolId = entry.id;
+        cont.spooled = d->spool->message(entry);
+        for (const QString &address : entry.recipients) {
+            ServerReply::RecipientStatus status;
+            status.address = address;
+            cont.recipients << status;
+        }
 
-    if (d->state == ServerPrivate::Disconnected) {
-        connectToServer();
-    } else if (d->state == ServerPrivate::Ready) {
-        d->processNextMail();
+        ret << cont.reply;
+        d->lanes[cont.priority].append(std::move(cont));
     }
 
-    return cont.reply.data();
+    if (!ret.isEmpty()) {
+        d->startQueue();
+    }
+    return ret;
 }
 
 int Server::queueSize() const
 {
     Q_D(const Server);
-    return d->queue.size();
+    int ret = d->queue.size() + d->retryQueue.size();
+    for (const RingBuffer<ServerReplyContainer> &lane : d->lanes) {
+        ret += lane.size();
+    }
+    return ret;
+}
+
+int Server::keepAliveInterval() const
+{
+    Q_D(const Server);
+    return d->keepAliveInterval;
+}
+
+void Server::setKeepAliveInterval(int msec)
+{
+    Q_D(Server);
+    d->keepAliveInterval = qMax(0, msec);
+    if (d->state == ServerPrivate::Ready) {
+        d->startKeepAlive();
+    }
+}
+
+bool Server::autoReconnect() const
+{
+    Q_D(const Server);
+    return d->autoReconnect;
+}
+
+void Server::setAutoReconnect(bool enable)
+{
+    Q_D(Server);
+    d->autoReconnect = enable;
+}
+
+int Server::connectTimeout() const
+{
+    Q_D(const Server);
+    return d->connectTimeout;
+}
+
+void Server::setConnectTimeout(int msec)
+{
+    Q_D(Server);
+    d->connectTimeout = qMax(0, msec);
+}
+
+int Server::greetingTimeout() const
+{
+    Q_D(const Server);
+    return d->greetingTimeout;
+}
+
+void Server::setGreetingTimeout(int msec)
+{
+    Q_D(Server);
+    d->greetingTimeout = qMax(0, msec);
+}
+
+int Server::commandTimeout() const
+{
+    Q_D(const Server);
+    return d->commandTimeout;
+}
+
+void Server::setCommandTimeout(int msec)
+{
+    Q_D(Server);
+    d->commandTimeout = qMax(0, msec);
+}
+
+int Server::sendDataTimeout() const
+{
+    Q_D(const Server);
+    return d->dataTimeout;
+}
+
+void Server::setSendDataTimeout(int msec)
+{
+    Q_D(Server);
+    d->dataTimeout = qMax(0, msec);
+}
+
+int Server::maxRetries() const
+{
+    Q_D(const Server);
+    return d->maxRetries;
+}
+
+void Server::setMaxRetries(int count)
+{
+    Q_D(Server);
+    d->maxRetries = qMax(0, count);
+}
+
+int Server::retryDelay() const
+{
+    Q_D(const Server);
+    return d->retryDelay;
+}
+
+void Server::setRetryDelay(int msec)
+{
+    Q_D(Server);
+    d->retryDelay = qMax(0, msec);
+}
+
+int Server::maxRetryDelay() const
+{
+    Q_D(const Server);
+    return d->maxRetryDelay;
+}
+
+void Server::setMaxRetryDelay(int msec)
+{
+    Q_D(Server);
+    d->maxRetryDelay = qMax(0, msec);
+}
+
+int Server::maxRecipients() const
+{
+    Q_D(const Server);
+    return d->maxRecipients;
+}
+
+void Server::setMaxRecipients(int count)
+{
+    Q_D(Server);
+    d->maxRecipients = qMax(0, count);
+}
+
+double Server::messageRate() const
+{
+    Q_D(const Server);
+    return d->rateLimiter->messages.rate();
+}
+
+void Server::setMessageRate(double perSecond)
+{
+    Q_D(Server);
+    d->rateLimiter->messages.setRate(perSecond);
+}
+
+double Server::recipientRate() const
+{
+    Q_D(const Server);
+    return d->rateLimiter->recipients.rate();
+}
+
+void Server::setRecipientRate(double perSecond)
+{
+    Q_D(Server);
+    d->rateLimiter->recipients.setRate(perSecond);
+}
+
+qint64 Server::byteRate() const
+{
+    Q_D(const Server);
+    return qint64(d->rateLimiter->bytes.rate());
+}
+
+void Server::setByteRate(qint64 perSecond)
+{
+    Q_D(Server);
+    d->rateLimiter->bytes.setRate(double(perSecond));
 }
 
 void Server::connectToServer()
 {
     Q_D(Server);
 
+    if (d->state != ServerPrivate::Disconnected) {
+        return;
+    }
+
     d->createSocket();
+#ifndef QT_NO_SSL
+    d->restoreTlsSession();
+#endif
 
     switch (d->connectionType) {
     case Server::TlsConnection:
@@ -183,6 +500,8 @@ void Server::connectToServer()
 #endif
     break;
     }
+
+    d->updateDeadline();
 }
 
 #ifndef QT_NO_SSL
@@ -203,6 +522,64 @@ void Server::ignoreSslErrors(const QList<QSslError> &errors)
         sslSock->ignoreSslErrors(errors);
     }
 }
+
+int Server::tlsHandshakeCount() const
+{
+    Q_D(const Server);
+    return d->tlsHandshakes;
+}
+
+int Server::tlsSessionOfferCount() const
+{
+    Q_D(const Server);
+    return d->tlsSessionOffers;
+}
+
+void ServerPrivate::restoreTlsSession()
+{
+    auto sslSock = qobject_cast<QSslSocket *>(socket);
+    if (!sslSock) {
+        return;
+    }
+
+    QByteArray ticket;
+    {
+        QMutexLocker locker(&tlsSessionCache->mutex);
+        ticket = tlsSessionCache->tickets.value(tlsCacheKey());
+    }
+
+    QSslConfiguration config = sslSock->sslConfiguration();
+    // Session persistence is needed to get the ticket after the handshake
+    config.setSslOption(QSsl::SslOptionDisableSessionPersistence, false);
+    config.setSessionTicket(ticket);
+    sslSock->setSslConfiguration(config);
+    tlsSessionOffered = !ticket.isEmpty();
+}
+
+void ServerPrivate::saveTlsSession()
+{
+    auto sslSock = qobject_cast<QSslSocket *>(socket);
+    if (!sslSock) {
+        return;
+    }
+
+    // Resuming doesn't verify the peer again, so only sessions that passed it are kept
+    if (peerVerificationType != Server::VerifyPeer || !sslSock->sslHandshakeErrors().isEmpty()) {
+        return;
+    }
+
+    const QByteArray ticket = sslSock->sslConfiguration().sessionTicket();
+    if (!ticket.isEmpty()) {
+        QMutexLocker locker(&tlsSessionCache->mutex);
+        tlsSessionCache->tickets.insert(tlsCacheKey(), ticket);
+    }
+}
+
+QString ServerPrivate::tlsCacheKey() const
+{
+    return cacheKey() + QLatin1Char('/') + QString::number(int(connectionType)) +
+           QLatin1Char('/') + QString::number(int(peerVerificationType));
+}
 #endif
 
 void ServerPrivate::createSocket()
@@ -228,6 +605,27 @@ void ServerPrivate::createSocket()
             q,
             &Server::sslErrors,
             Qt::DirectConnection);
+        q->connect(static_cast<QSslSocket *>(socket),
+                   &QSslSocket::encryptedBytesWritten,
+                   q,
+                   [=] {
+                       updateDeadline();
+                       pumpData();
+                   });
+        q->connect(static_cast<QSslSocket *>(socket), &QSslSocket::encrypted, q, [=] {
+            ++tlsHandshakes;
+            if (tlsSessionOffered) {
+                ++tlsSessionOffers;
+            }
+            saveTlsSession();
+        });
+#if (QT_VERSION >= QT_VERSION_CHECK(5, 15, 0))
+        // TLS 1.3 tickets only arrive after the handshake
+        q->connect(static_cast<QSslSocket *>(socket),
+                   &QSslSocket::newSessionTicketReceived,
+                   q,
+                   [=] { saveTlsSession(); });
+#endif
 #else
         qFatal("QT_NO_SSL defined, can't send emails");
 #endif
@@ -237,9 +635,22 @@ void ServerPrivate::createSocket()
         if (sockState == QAbstractSocket::ClosingState) {
             state = Closing;
         } else if (sockState == QAbstractSocket::UnconnectedState) {
-            state = Disconnected;
-            if (!queue.isEmpty()) {
-                q->connectToServer();
+            const bool wasReady = connectionReady;
+            connectionReady     = false;
+            state               = Disconnected;
+            keepAliveAt         = -1;
+            replies.clear();
+            updateDeadline();
+            resetEnvelopes();
+            if (hasMail()) {
+                // Unless a retry backoff is in place
+                if (reconnectAt < 0) {
+                    q->connectToServer();
+                }
+            } else if (autoReconnect && wasReady) {
+                // Warm up a new connection for the next email
+                qCDebug(SIMPLEMAIL_SERVER) << "Idle connection dropped, reconnecting";
+                QTimer::singleShot(ReconnectDelay, q, [=] { q->connectToServer(); });
             }
         }
     });
@@ -247,19 +658,19 @@ void ServerPrivate::createSocket()
     q->connect(socket, &QTcpSocket::connected, q, [=]() {
         qCDebug(SIMPLEMAIL_SERVER) << "connected" << state << socket->readAll();
         state = WaitingForServiceReady220;
+        updateDeadline();
+    });
+
+    q->connect(socket, &QTcpSocket::bytesWritten, q, [=] {
+        // Any progress moves the deadline forward
+        updateDeadline();
+        pumpData();
     });
 
     auto erroFn = [=](QAbstractSocket::SocketError error) {
         qCDebug(SIMPLEMAIL_SERVER) << "SocketError" << error << socket->readAll();
-        if (!queue.isEmpty()) {
-            ServerReplyContainer &cont = queue[0];
-            if (!cont.reply.isNull()) {
-                ServerReply *reply = cont.reply;
-                queue.removeFirst();
-                reply->finish(true, -1, socket->errorString());
-            } else {
-                queue.removeFirst();
-            }
+        if (hasMail()) {
+            requeueMails(-1, socket->errorString());
         }
     };
 #if (QT_VERSION >= QT_VERSION_CHECK(5, 15, 0))
@@ -273,197 +684,125 @@ void ServerPrivate::createSocket()
 
     q->connect(socket, &QTcpSocket::readyRead, q, [=] {
         qCDebug(SIMPLEMAIL_SERVER) << "readyRead" << socket->bytesAvailable();
-        switch (state) {
-        case SendingMail:
-            while (socket->canReadLine()) {
-                if (!queue.isEmpty()) {
-                    ServerReplyContainer &cont = queue[0];
-                    if (cont.state == ServerReplyContainer::SendingCommands) {
-                        while (!cont.awaitedCodes.isEmpty() && socket->canReadLine()) {
-                            const int awaitedCode = cont.awaitedCodes.takeFirst();
-
-                            QByteArray responseText;
-                            const int code = parseResponseCode(&responseText);
-                            if (code != awaitedCode) {
-                                // Reset connection
-                                if (!cont.reply.isNull()) {
-                                    ServerReply *reply = cont.reply;
-                                    queue.removeFirst();
-                                    reply->finish(true, code, QString::fromLatin1(responseText));
-                                } else {
-                                    queue.removeFirst();
-                                }
-                                const QByteArray consume = socket->readAll();
-                                qDebug() << "Mail error" << consume;
-                                state = Ready;
-                                commandReset();
-                                return;
-                            }
-
-                            if (!capPipelining && !cont.awaitedCodes.isEmpty()) {
-                                // Write next command
-                                socket->write(
-                                    cont.commands[cont.commands.size() - cont.awaitedCodes.size()]);
-                            }
-                        }
-
-                        if (cont.awaitedCodes.isEmpty()) {
-                            cont.state = ServerReplyContainer::SendingData;
-                            if (cont.msg.write(socket) &&
-                                socket->write(QByteArrayLiteral("\r\n.\r\n")) == 5) {
-                                qCDebug(SIMPLEMAIL_SERVER) << "Mail sent";
-                            } else {
-                                qCCritical(SIMPLEMAIL_SERVER) << "Error writing mail";
-                                if (!cont.reply.isNull()) {
-                                    ServerReply *reply = cont.reply;
-                                    queue.removeFirst();
-                                    reply->finish(true, -1, q->tr("Error sending mail DATA"));
-                                } else {
-                                    queue.removeFirst();
-                                }
-                                socket->disconnectFromHost();
-                                return;
-                            }
-                        }
-                    } else if (cont.state == ServerReplyContainer::SendingData) {
-                        QByteArray responseText;
-                        const int code = parseResponseCode(&responseText);
-                        if (!cont.reply.isNull()) {
-                            ServerReply *reply = cont.reply;
-                            queue.removeFirst();
-                            reply->finish(code != 250, code, QString::fromLatin1(responseText));
-                        } else {
-                            queue.removeFirst();
-                        }
-                        qCDebug(SIMPLEMAIL_SERVER)
-                            << "MAIL FINISHED" << code << queue.size() << socket->canReadLine();
-
-                        processNextMail();
-                    }
-                } else {
-                    state = Ready;
-                    break;
-                }
-            }
-            break;
-        case WaitingForServerCaps250:
-            while (socket->canReadLine()) {
-                int ret = parseCaps();
-                if (ret != 0 && ret == 1) {
-                    qCDebug(SIMPLEMAIL_SERVER) << "CAPS" << caps;
-                    capPipelining = caps.contains(QStringLiteral("250-PIPELINING"));
+        replies.feed(socket);
+        while (replies.next()) {
+            qCDebug(SIMPLEMAIL_SERVER) << "Got response" << replies.lastLine();
+            processReply();
+        }
+        updateDeadline();
+    });
+}
+
+void ServerPrivate::processReply()
+{
+    switch (state) {
+    case SendingMail:
+        readMailReply();
+        break;
+    case WaitingForServerCaps250:
+        if (parseCaps()) {
+            qCDebug(SIMPLEMAIL_SERVER) << "CAPS" << capabilities.extensions();
 #ifndef QT_NO_SSL
-                    if (connectionType == Server::TlsConnection) {
-                        auto sslSocket = qobject_cast<QSslSocket *>(socket);
-                        if (sslSocket) {
-                            if (!sslSocket->isEncrypted()) {
-                                qCDebug(SIMPLEMAIL_SERVER) << "Sending STARTTLS";
-                                socket->write(QByteArrayLiteral("STARTTLS\r\n"));
-                                state = WaitingForServerStartTls_220;
-                            } else {
-                                login();
-                            }
-                        }
+            if (connectionType == Server::TlsConnection) {
+                auto sslSocket = qobject_cast<QSslSocket *>(socket);
+                if (sslSocket) {
+                    if (!sslSocket->isEncrypted()) {
+                        qCDebug(SIMPLEMAIL_SERVER) << "Sending STARTTLS";
+                        socket->write(QByteArrayLiteral("STARTTLS\r\n"));
+                        state = WaitingForServerStartTls_220;
                     } else {
                         login();
                     }
-#else
-                    login();
-#endif
-                    break;
-                } else if (ret == -1) {
-                    break;
                 }
+            } else {
+                login();
             }
-            break;
-        case WaitingForServerStartTls_220:
-            if (socket->canReadLine()) {
-                if (parseResponseCode(220)) {
-#ifndef QT_NO_SSL
-                    auto sslSock = qobject_cast<QSslSocket *>(socket);
-                    if (sslSock) {
-                        qCDebug(SIMPLEMAIL_SERVER) << "Starting client encryption";
-                        sslSock->startClientEncryption();
-
-                        // This will be queued and sent once the connection get's encrypted
-                        socket->write("EHLO " + hostname.toLatin1() + "\r\n");
-                        state = WaitingForServerCaps250;
-                        caps.clear();
-                    }
+#else
+            login();
 #endif
-                }
-            }
-            break;
-        case Noop_250:
-        case Reset_250:
-            if (parseResponseCode(250)) {
-                qCDebug(SIMPLEMAIL_SERVER) << "Got NOOP/RSET OK";
-                state = Ready;
-                processNextMail();
-            }
-            break;
-        case WaitingForAuthPlain235:
-        case WaitingForAuthLogin235_step3:
-        case WaitingForAuthCramMd5_235_step2:
-            if (socket->canReadLine()) {
-                if (parseResponseCode(235, Server::AuthenticationFailedError)) {
-                    state = Ready;
-                    processNextMail();
-                }
-            }
-            break;
-        case WaitingForAuthLogin334_step1:
-            if (socket->canReadLine()) {
-                if (parseResponseCode(334, Server::AuthenticationFailedError)) {
-                    // Send the username in base64
-                    qCDebug(SIMPLEMAIL_SERVER) << "Sending authentication user" << username;
-                    socket->write(username.toUtf8().toBase64() + "\r\n");
-                    state = WaitingForAuthLogin334_step2;
-                }
-            }
-            break;
-        case WaitingForAuthLogin334_step2:
-            if (socket->canReadLine()) {
-                if (parseResponseCode(334, Server::AuthenticationFailedError)) {
-                    // Send the password in base64
-                    qCDebug(SIMPLEMAIL_SERVER) << "Sending authentication password";
-                    socket->write(password.toUtf8().toBase64() + "\r\n");
-                    state = WaitingForAuthLogin235_step3;
-                }
-            }
-            break;
-        case WaitingForAuthCramMd5_334_step1:
-            if (socket->canReadLine()) {
-                QByteArray responseMessage;
-                if (parseResponseCode(334, Server::AuthenticationFailedError, &responseMessage)) {
-                    // Challenge
-                    QByteArray ch = QByteArray::fromBase64(responseMessage);
-
-                    // Compute the hash
-                    QMessageAuthenticationCode code(QCryptographicHash::Md5);
-                    code.setKey(password.toUtf8());
-                    code.addData(ch);
-
-                    QByteArray data(username.toUtf8() + " " + code.result().toHex());
-                    socket->write(data.toBase64() + "\r\n");
-                    state = WaitingForAuthCramMd5_235_step2;
-                }
-            }
-            break;
-        case WaitingForServiceReady220:
-            if (socket->canReadLine()) {
-                if (parseResponseCode(220)) {
-                    // The client's first command must be EHLO/HELO
-                    socket->write("EHLO " + hostname.toLatin1() + "\r\n");
-                    state = WaitingForServerCaps250;
-                }
+        }
+        break;
+    case WaitingForServerStartTls_220:
+        if (parseResponseCode(220)) {
+#ifndef QT_NO_SSL
+            auto sslSock = qobject_cast<QSslSocket *>(socket);
+            if (sslSock) {
+                qCDebug(SIMPLEMAIL_SERVER) << "Starting client encryption";
+                sslSock->startClientEncryption();
+
+                // Anything received after the 220 was not protected by TLS
+                replies.clear();
+
+                // This will be queued and sent once the connection get's encrypted
+                socket->write("EHLO " + hostname.toLatin1() + "\r\n");
+                state = WaitingForServerCaps250;
+                capabilities = ServerCapabilities();
             }
-            break;
-        default:
-            qCDebug(SIMPLEMAIL_SERVER) << "readyRead unknown state" << socket->readAll() << state;
+#endif
         }
-        qCDebug(SIMPLEMAIL_SERVER) << "readyRead" << socket->bytesAvailable();
-    });
+        break;
+    case Noop_250:
+    case Reset_250:
+        if (parseResponseCode(250)) {
+            qCDebug(SIMPLEMAIL_SERVER) << "Got NOOP/RSET OK";
+            state = Ready;
+            processNextMail();
+        }
+        break;
+    case WaitingForAuthPlain235:
+    case WaitingForAuthLogin235_step3:
+    case WaitingForAuthCramMd5_235_step2:
+        if (parseResponseCode(235, Server::AuthenticationFailedError)) {
+            rememberAuthMethod();
+            connectionReady = true;
+            connectFailures = 0;
+            state           = Ready;
+            processNextMail();
+        }
+        break;
+    case WaitingForAuthLogin334_step1:
+        if (parseResponseCode(334, Server::AuthenticationFailedError)) {
+            // Send the username in base64
+            qCDebug(SIMPLEMAIL_SERVER) << "Sending authentication user" << username;
+            socket->write(username.toUtf8().toBase64() + "\r\n");
+            state = WaitingForAuthLogin334_step2;
+        }
+        break;
+    case WaitingForAuthLogin334_step2:
+        if (parseResponseCode(334, Server::AuthenticationFailedError)) {
+            // Send the password in base64
+            qCDebug(SIMPLEMAIL_SERVER) << "Sending authentication password";
+            socket->write(password.toUtf8().toBase64() + "\r\n");
+            state = WaitingForAuthLogin235_step3;
+        }
+        break;
+    case WaitingForAuthCramMd5_334_step1:
+        if (parseResponseCode(334, Server::AuthenticationFailedError)) {
+            // Challenge
+            const QLatin1String challenge = replies.text();
+            QByteArray ch                 = QByteArray::fromBase64(
+                QByteArray::fromRawData(challenge.data(), challenge.size()));
+
+            // Compute the hash
+            QMessageAuthenticationCode code(QCryptographicHash::Md5);
+            code.setKey(password.toUtf8());
+            code.addData(ch);
+
+            QByteArray data(username.toUtf8() + " " + code.result().toHex());
+            socket->write(data.toBase64() + "\r\n");
+            state = WaitingForAuthCramMd5_235_step2;
+        }
+        break;
+    case WaitingForServiceReady220:
+        if (parseResponseCode(220)) {
+            // The client's first command must be EHLO/HELO
+            socket->write("EHLO " + hostname.toLatin1() + "\r\n");
+            state = WaitingForServerCaps250;
+        }
+        break;
+    default:
+        qCDebug(SIMPLEMAIL_SERVER) << "Reply on unknown state" << replies.lastLine() << state;
+    }
 }
 
 void ServerPrivate::setPeerVerificationType(const Server::PeerVerificationType &type)
@@ -488,196 +827,1111 @@ void ServerPrivate::setPeerVerificationType(const Server::PeerVerificationType &
 
 void ServerPrivate::login()
 {
-    qCDebug(SIMPLEMAIL_SERVER) << "LOGIN" << authMethod;
-    if (authMethod == Server::AuthPlain) {
+    loginMethod = authMethod == Server::AuthAuto ? selectAuthMethod() : authMethod;
+
+    qCDebug(SIMPLEMAIL_SERVER) << "LOGIN" << authMethod << loginMethod;
+    if (loginMethod == Server::AuthPlain) {
         qCDebug(SIMPLEMAIL_SERVER) << "Sending authentication plain" << state;
         // Sending command: AUTH PLAIN base64('\0' + username + '\0' + password)
         const QByteArray plain = '\0' + username.toUtf8() + '\0' + password.toUtf8();
         socket->write(QByteArrayLiteral("AUTH PLAIN ") + plain.toBase64() + "\r\n");
         state = WaitingForAuthPlain235;
-    } else if (authMethod == Server::AuthLogin) {
+    } else if (loginMethod == Server::AuthLogin) {
         // Sending command: AUTH LOGIN
         qCDebug(SIMPLEMAIL_SERVER) << "Sending authentication login";
         socket->write(QByteArrayLiteral("AUTH LOGIN\r\n"));
         state = WaitingForAuthLogin334_step1;
-    } else if (authMethod == Server::AuthCramMd5) {
+    } else if (loginMethod == Server::AuthCramMd5) {
         // NOTE Implementando - Ready
         qCDebug(SIMPLEMAIL_SERVER) << "Sending authentication CRAM-MD5";
         socket->write(QByteArrayLiteral("AUTH CRAM-MD5\r\n"));
         state = WaitingForAuthCramMd5_334_step1;
     } else {
-        state = ServerPrivate::Ready;
+        connectionReady = true;
+        connectFailures = 0;
+        state           = ServerPrivate::Ready;
         processNextMail();
     }
 }
 
+Server::AuthMethod ServerPrivate::selectAuthMethod() const
+{
+    const QStringList mechanisms = capabilities.authMechanisms();
+    const auto advertised        = [&mechanisms](Server::AuthMethod method) {
+        switch (method) {
+        case Server::AuthPlain:
+            return mechanisms.contains(QLatin1String("PLAIN"));
+        case Server::AuthLogin:
+            return mechanisms.contains(QLatin1String("LOGIN"));
+        case Server::AuthCramMd5:
+            return mechanisms.contains(QLatin1String("CRAM-MD5"));
+        default:
+            return false;
+        }
+    };
+
+    {
+        QMutexLocker locker(&authMethodCache->mutex);
+        const Server::AuthMethod cached =
+            authMethodCache->methods.value(cacheKey(), Server::AuthNone);
+        if (cached != Server::AuthNone && advertised(cached)) {
+            return cached;
+        }
+    }
+
+    // PLAIN sends the credentials with the command, a single round trip,
+    // CRAM-MD5 needs two and LOGIN three
+    for (Server::AuthMethod method : {Server::AuthPlain, Server::AuthCramMd5, Server::AuthLogin}) {
+        if (advertised(method)) {
+            return method;
+        }
+    }
+
+    // Credentials are never sent to a server that didn't offer to take them,
+    // one that requires them refuses the mail instead
+    qCWarning(SIMPLEMAIL_SERVER) << "Server advertises no supported AUTH mechanism"
+                                 << mechanisms << "sending without authentication";
+    return Server::AuthNone;
+}
+
+void ServerPrivate::rememberAuthMethod()
+{
+    if (authMethod == Server::AuthAuto) {
+        QMutexLocker locker(&authMethodCache->mutex);
+        authMethodCache->methods.insert(cacheKey(), loginMethod);
+    }
+}
+
+QString ServerPrivate::cacheKey() const
+{
+    return host + QLatin1Char(':') + QString::number(port);
+}
+
+void ServerPrivate::startQueue()
+{
+    Q_Q(Server);
+
+    if (state == Disconnected) {
+        q->connectToServer();
+    } else if (state == Ready) {
+        processNextMail();
+        updateDeadline();
+    }
+}
+
 void ServerPrivate::processNextMail()
 {
-    while (!queue.isEmpty()) {
-        ServerReplyContainer &cont = queue[0];
-        if (cont.reply.isNull()) {
-            queue.removeFirst();
-            continue;
+    // Keep sendMail() from re-entering while failed or expired replies finish
+    state = SendingMail;
+
+    while (!queue.isEmpty() || promoteNextMail()) {
+        if (queue[0].state == ServerReplyContainer::Initial && !queue[0].reply.isNull()) {
+            splitEnvelope(0);
         }
 
+        ServerReplyContainer &cont = queue[0];
         if (cont.state == ServerReplyContainer::Initial) {
-            // Send the MAIL command with the sender
-            cont.commands << "MAIL FROM:<" + cont.msg.sender().address().toLatin1() + ">\r\n";
-            cont.awaitedCodes << 250;
-
-            // Send RCPT command for each recipient
-            // To (primary recipients)
-            const auto toRecipients = cont.msg.toRecipients();
-            for (const EmailAddress &rcpt : toRecipients) {
-                cont.commands << "RCPT TO:<" + rcpt.address().toLatin1() + ">\r\n";
-                cont.awaitedCodes << 250;
+            if (isCancelled(cont)) {
+                queue.removeFirst();
+                continue;
             }
 
-            // Cc (carbon copy)
-            const auto ccRecipients = cont.msg.ccRecipients();
-            for (const EmailAddress &rcpt : ccRecipients) {
-                cont.commands << "RCPT TO:<" + rcpt.address().toLatin1() + ">\r\n";
-                cont.awaitedCodes << 250;
+            if (rateLimited(rateLimiter->transactionDelay())) {
+                // The ticker resumes the queue
+                state = Ready;
+                return;
             }
+            rateLimiter->startTransaction(cont.recipients.size());
 
-            // Bcc (blind carbon copy)
-            const auto bccRecipients = cont.msg.bccRecipients();
-            for (const EmailAddress &rcpt : bccRecipients) {
-                cont.commands << "RCPT TO:<" + rcpt.address().toLatin1() + ">\r\n";
-                cont.awaitedCodes << 250;
+            int errorCode = 0;
+            QString errorText;
+            if (!prepareEnvelope(cont, errorCode, errorText)) {
+                finishMail(true, errorCode, errorText);
+                continue;
             }
+            sendEnvelope(cont);
+        } else if (cont.state == ServerReplyContainer::SendingCommands && cont.chunking &&
+                   hasCap(ServerCapabilities::Pipelining)) {
+            // The envelope was pipelined behind the previous mail,
+            // it's BDAT chunks can follow it now
+            startData(cont);
+        } else {
+            // The envelope was pipelined behind the previous mail,
+            // it's replies are already on their way
+            pumpData();
+        }
+        return;
+    }
 
-            // DATA command
-            cont.commands << QByteArrayLiteral("DATA\r\n");
-            cont.awaitedCodes << 354;
+    state = Ready;
+    startKeepAlive();
+}
 
-            qCDebug(SIMPLEMAIL_SERVER)
-                << "Sending MAIL command" << capPipelining << cont.commands.size() << cont.commands
-                << cont.awaitedCodes;
-            if (capPipelining) {
-                for (const QByteArray &cmd : qAsConst(cont.commands)) {
-                    socket->write(cmd);
-                }
-            } else {
-                socket->write(cont.commands.first());
+bool ServerPrivate::hasMail() const
+{
+    if (!queue.isEmpty()) {
+        return true;
+    }
+
+    for (const RingBuffer<ServerReplyContainer> &lane : lanes) {
+        if (!lane.isEmpty()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool ServerPrivate::promoteNextMail()
+{
+    // Strict priority, a lane is only served once the ones above it are empty
+    for (RingBuffer<ServerReplyContainer> &lane : lanes) {
+        while (!lane.isEmpty()) {
+            ServerReplyContainer cont = lane.takeFirst();
+            if (isCancelled(cont) || dropExpired(cont)) {
+                continue;
             }
 
-            state      = SendingMail;
-            cont.state = ServerReplyContainer::SendingCommands;
-            return;
+            queue.append(std::move(cont));
+            return true;
+        }
+    }
+    return false;
+}
+
+bool ServerPrivate::dropExpired(ServerReplyContainer &cont)
+{
+    Q_Q(Server);
+
+    if (!cont.expiry.hasExpired()) {
+        return false;
+    }
+
+    qCDebug(SIMPLEMAIL_SERVER) << "Dropping expired mail, attempts" << cont.attempts;
+    finishShard(cont, true, -1, q->tr("Mail expired before being sent"));
+    return true;
+}
+
+bool ServerPrivate::isCancelled(const ServerReplyContainer &cont)
+{
+    if (!cont.reply.isNull()) {
+        return false;
+    }
+
+    // The reply was deleted so it's not sent, not even after a restart
+    spoolFinished(cont, false);
+    return true;
+}
+
+void ServerPrivate::startKeepAlive()
+{
+    if (keepAliveInterval <= 0) {
+        keepAliveAt = -1;
+        return;
+    }
+
+    startTicker();
+    keepAliveAt = clock.elapsed() + keepAliveInterval;
+}
+
+bool ServerPrivate::rateLimited(qint64 delay)
+{
+    if (delay <= 0) {
+        return false;
+    }
+
+    startTicker();
+    const qint64 at = clock.elapsed() + delay;
+    if (resumeAt < 0 || at < resumeAt) {
+        resumeAt = at;
+    }
+    return true;
+}
+
+void ServerPrivate::updateDeadline()
+{
+    int timeout = 0;
+    switch (state) {
+    case Disconnected:
+    case Closing:
+    case Ready:
+        break;
+    case Connecting:
+        timeout       = connectTimeout;
+        deadlineError = Server::ConnectionTimeoutError;
+        break;
+    case WaitingForServiceReady220:
+        timeout       = greetingTimeout;
+        deadlineError = Server::ResponseTimeoutError;
+        break;
+    default:
+        if (bytesToWrite() > 0) {
+            timeout       = dataTimeout;
+            deadlineError = Server::SendDataTimeoutError;
         } else {
-            return;
+            timeout       = commandTimeout;
+            deadlineError = Server::ResponseTimeoutError;
         }
+        break;
     }
 
-    state = Ready;
+    if (timeout <= 0) {
+        deadline = -1;
+        return;
+    }
+
+    startTicker();
+    deadline = clock.elapsed() + timeout;
+}
+
+void ServerPrivate::startTicker()
+{
+    Q_Q(Server);
+
+    // A single coarse timer serves every deadline of the connection,
+    // so sending an email doesn't start and stop timers
+    if (!ticker) {
+        ticker = new QTimer(q);
+        ticker->setInterval(TickInterval);
+        ticker->setTimerType(Qt::CoarseTimer);
+        q->connect(ticker, &QTimer::timeout, q, [=] { checkDeadlines(); });
+        clock.start();
+    }
+
+    if (!ticker->isActive()) {
+        ticker->start();
+    }
+}
+
+void ServerPrivate::checkDeadlines()
+{
+    Q_Q(Server);
+
+    const qint64 now = clock.elapsed();
+    if (deadline >= 0 && now >= deadline) {
+        deadline = -1;
+        qCWarning(SIMPLEMAIL_SERVER) << "Deadline expired" << state << deadlineError;
+
+        QString error;
+        switch (deadlineError) {
+        case Server::ConnectionTimeoutError:
+            error = q->tr("Connection timed out");
+            break;
+        case Server::SendDataTimeoutError:
+            error = q->tr("Sending data timed out");
+            break;
+        default:
+            error = q->tr("Server response timed out");
+            break;
+        }
+        if (deadlineError != Server::SendDataTimeoutError) {
+            // The server is too busy to answer, unlike a slow upload on our side
+            notifyThrottled();
+        }
+        // Moves on in bounded time, even if the socket never errors
+        requeueMails(-1, error);
+        socket->abort();
+        Q_EMIT q->smtpError(deadlineError, error);
+    }
+
+    if (keepAliveAt >= 0 && now >= keepAliveAt) {
+        // A NOOP reply goes through processNextMail() which schedules the next one
+        keepAliveAt = -1;
+        if (!hasMail()) {
+            commandNoop();
+        }
+    }
+
+    if (reconnectAt >= 0 && now >= reconnectAt) {
+        reconnectAt = -1;
+        if (hasMail()) {
+            q->connectToServer();
+        }
+    }
+
+    if (!retryQueue.isEmpty()) {
+        requeueRetries();
+    }
+
+    if (resumeAt >= 0 && now >= resumeAt) {
+        resumeAt = -1;
+        if (state == Ready) {
+            processNextMail();
+            updateDeadline();
+        } else if (state == SendingMail) {
+            pumpData();
+        }
+    }
+
+    if (deadline < 0 && keepAliveAt < 0 && reconnectAt < 0 && resumeAt < 0 &&
+        retryQueue.isEmpty()) {
+        ticker->stop();
+    }
+}
+
+void ServerPrivate::pipelineNextMail()
+{
+    // RFC 2920 allows the next envelope to follow the end of the mail data
+    while (queue.size() > 1 || (queue.size() == 1 && promoteNextMail())) {
+        if (queue[1].state != ServerReplyContainer::Initial) {
+            return;
+        }
+
+        if (isCancelled(queue[1])) {
+            queue.removeAt(1);
+            continue;
+        }
+
+        if (rateLimiter->transactionDelay() > 0) {
+            // processNextMail() waits for it
+            return;
+        }
+
+        splitEnvelope(1);
+        ServerReplyContainer &cont = queue[1];
+        rateLimiter->startTransaction(cont.recipients.size());
+
+        int errorCode = 0;
+        QString errorText;
+        if (!prepareEnvelope(cont, errorCode, errorText)) {
+            ServerReplyContainer failed = queue.takeAt(1);
+            finishShard(failed, true, errorCode, errorText);
+            continue;
+        }
+
+        qCDebug(SIMPLEMAIL_SERVER) << "Pipelining next mail envelope";
+        sendEnvelope(cont);
+        return;
+    }
 }
 
-bool ServerPrivate::parseResponseCode(int expectedCode,
-                                      Server::SmtpError defaultError,
-                                      QByteArray *responseMessage)
+bool ServerPrivate::prepareEnvelope(ServerReplyContainer &cont, int &errorCode, QString &errorText)
 {
-    while (socket->canReadLine()) {
-        // Save the server's response
-        const QByteArray responseText = socket->readLine().trimmed();
-        const int responseSize        = responseText.size();
-        qCDebug(SIMPLEMAIL_SERVER) << "Got response" << responseText << "expected" << expectedCode;
+    Q_Q(Server);
 
-        // Extract the respose code from the server's responce (first 3 digits)
-        const int responseCode = responseText.left(3).toInt();
+    // The content goes in BDAT chunks (RFC 3030) which don't wait for a 354
+    cont.chunking = hasCap(ServerCapabilities::Chunking);
+
+    // Send the MAIL command with the sender
+    QByteArray mailFrom = "MAIL FROM:<" + cont.msg.sender().address().toLatin1() + '>';
+    // A spooled message was rendered for 7bit transports
+    if (bodyEncodingNegotiation && !cont.spooled) {
+        // BINARYMIME can only be transferred with BDAT
+        if (hasCap(ServerCapabilities::BinaryMime) && hasCap(ServerCapabilities::Chunking)) {
+            cont.bodyEncoding = MimeStream::BinaryMime;
+            mailFrom += " BODY=BINARYMIME";
+        } else if (hasCap(ServerCapabilities::EightBitMime)) {
+            cont.bodyEncoding = MimeStream::EightBitMime;
+            mailFrom += " BODY=8BITMIME";
+        }
+    }
 
-        if (responseCode / 100 == 4) {
-            failConnection(Server::ServerError, responseCode, QString::fromLatin1(responseText));
+    const std::shared_ptr<EnvelopeShards> &shards = cont.shards;
+    if (shards && shards->stream && shards->chunking == cont.chunking &&
+        shards->bodyEncoding == cont.bodyEncoding) {
+        // Another transaction of this mail already rendered it
+        cont.stream = shards->stream;
+        cont.stream->rewind();
+    } else {
+        // Only the headers are rendered here, the content is encoded as the socket drains
+        cont.stream = std::make_shared<MimeStream>();
+        cont.stream->setBodyEncoding(cont.bodyEncoding);
+        if (cont.spooled) {
+            cont.stream->appendMessage(cont.spooled);
+        } else if (!cont.msg.write(cont.stream.get())) {
+            errorCode = -1;
+            errorText = q->tr("Error writing mail");
             return false;
         }
 
-        if (responseCode / 100 == 5) {
-            failConnection(Server::ClientError, responseCode, QString::fromLatin1(responseText));
+        if (shards) {
+            shards->stream       = cont.stream;
+            shards->chunking     = cont.chunking;
+            shards->bodyEncoding = cont.bodyEncoding;
+        }
+    }
+
+    if (cont.chunking) {
+        cont.dotStuffing.reset();
+    } else {
+        cont.dotStuffing = std::make_unique<DotStuffingDevice>(cont.stream.get());
+    }
+
+    if (hasCap(ServerCapabilities::Size)) {
+        // RFC 1870, refuse locally what the server would reject after the transfer,
+        // the size doesn't count the dots doubled for DATA
+        const qint64 size      = cont.stream->encodedSize();
+        const qint64 sizeLimit = capabilities.sizeLimit();
+        if (sizeLimit > 0 && size > sizeLimit) {
+            qCWarning(SIMPLEMAIL_SERVER)
+                << "Message size" << size << "exceeds server limit" << sizeLimit;
+            errorCode = 552;
+            errorText = q->tr("Message size of %1 bytes exceeds the server limit of %2 bytes")
+                            .arg(size)
+                            .arg(sizeLimit);
             return false;
         }
 
-        if (responseSize >= 4 && responseText[3] == '-') {
-            if (responseCode != expectedCode) {
-                const QString lastError = QString::fromLatin1(responseText);
-                qCWarning(SIMPLEMAIL_SERVER)
-                    << "Unexpected server response" << lastError << expectedCode;
-                failConnection(defaultError, responseCode, lastError);
-                return false;
+        if (size >= 0) {
+            mailFrom += " SIZE=" + QByteArray::number(size);
+        }
+    }
+    if (spool && cont.spoolId) {
+        spool->setInFlight(cont.spoolId);
+    }
+
+    // All the commands go in one buffer, so pipelining writes them at once
+    cont.commands.reserve(mailFrom.size() + 16 + cont.recipients.size() * 48);
+    cont.addCommand(mailFrom + "\r\n", 250);
+
+    // Send RCPT command for each recipient of this transaction
+    for (const ServerReply::RecipientStatus &rcpt : qAsConst(cont.recipients)) {
+        cont.addCommand("RCPT TO:<" + rcpt.address.toLatin1() + ">\r\n", 250);
+    }
+
+    if (!cont.chunking) {
+        // DATA command
+        cont.addCommand(QByteArrayLiteral("DATA\r\n"), 354);
+    }
+
+    return true;
+}
+
+void ServerPrivate::listRecipients(ServerReplyContainer &cont)
+{
+    if (!cont.recipients.isEmpty()) {
+        return;
+    }
+
+    auto addRecipients = [&cont](const QList<EmailAddress> &addresses) {
+        for (const EmailAddress &rcpt : addresses) {
+            ServerReply::RecipientStatus status;
+            status.address = rcpt.address();
+            cont.recipients << status;
+        }
+    };
+
+    // To (primary recipients), Cc (carbon copy) and Bcc (blind carbon copy)
+    addRecipients(cont.msg.toRecipients());
+    addRecipients(cont.msg.ccRecipients());
+    addRecipients(cont.msg.bccRecipients());
+}
+
+void ServerPrivate::splitEnvelope(int index)
+{
+    ServerReplyContainer &cont = queue[index];
+    listRecipients(cont);
+
+    const int limit = recipientLimit();
+    const int count = cont.recipients.size();
+    if (limit <= 0 || count <= limit) {
+        return;
+    }
+
+    qCDebug(SIMPLEMAIL_SERVER) << "Splitting" << count << "recipients in transactions of"
+                               << limit;
+    ensureShards(cont);
+    std::vector<ServerReplyContainer> shards;
+    for (int begin = limit; begin < count; begin += limit) {
+        QList<int> positions;
+        for (int i = begin; i < qMin(begin + limit, count); ++i) {
+            positions << i;
+        }
+        shards.push_back(makeShard(cont, positions));
+    }
+    cont.recipients.erase(cont.recipients.begin() + limit, cont.recipients.end());
+    cont.recipientIndex.erase(cont.recipientIndex.begin() + limit, cont.recipientIndex.end());
+
+    // The other transactions are next in line for the mail priority,
+    // so mails of a higher one still go in between
+    RingBuffer<ServerReplyContainer> &lane = lanes[cont.priority];
+    lane.reserve(lane.size() + int(shards.size()));
+    int position = 0;
+    for (ServerReplyContainer &shard : shards) {
+        lane.insert(position++, std::move(shard));
+    }
+}
+
+ServerReplyContainer ServerPrivate::makeShard(const ServerReplyContainer &source,
+                                              const QList<int> &positions)
+{
+    ServerReplyContainer shard(source.msg);
+    shard.reply    = source.reply;
+    shard.shards   = source.shards;
+    shard.spooled  = source.spooled;
+    shard.spoolId  = source.spoolId;
+    shard.expiry   = source.expiry;
+    shard.priority = source.priority;
+    for (int position : positions) {
+        shard.recipients << source.recipients.at(position);
+        shard.recipientIndex << source.recipientIndex.at(position);
+    }
+    shard.reset();
+
+    ++shard.shards->pending;
+    return shard;
+}
+
+void ServerPrivate::ensureShards(ServerReplyContainer &cont)
+{
+    if (cont.shards) {
+        return;
+    }
+
+    cont.shards             = std::make_shared<EnvelopeShards>();
+    cont.shards->recipients = cont.recipients;
+    cont.recipientIndex.clear();
+    for (int i = 0; i < cont.recipients.size(); ++i) {
+        cont.recipientIndex << i;
+    }
+}
+
+int ServerPrivate::recipientLimit() const
+{
+    if (maxRecipients > 0 && learnedRecipientLimit > 0) {
+        return qMin(maxRecipients, learnedRecipientLimit);
+    }
+    return qMax(maxRecipients, learnedRecipientLimit);
+}
+
+void ServerPrivate::sendEnvelope(ServerReplyContainer &cont)
+{
+    qCDebug(SIMPLEMAIL_SERVER) << "Sending MAIL command" << hasCap(ServerCapabilities::Pipelining)
+                               << cont.commandEnds.size() << cont.commands;
+    if (hasCap(ServerCapabilities::Pipelining)) {
+        socket->write(cont.commands);
+    } else {
+        socket->write(cont.command(0));
+    }
+
+    state      = SendingMail;
+    cont.state = ServerReplyContainer::SendingCommands;
+
+    if (cont.chunking && hasCap(ServerCapabilities::Pipelining) && &cont == &queue[0]) {
+        // BDAT chunks are pipelined right after the envelope, one pipelined
+        // behind the previous mail starts them once it reaches the front
+        startData(cont);
+    }
+}
+
+void ServerPrivate::resetEnvelopes()
+{
+    // Envelopes sent on a lost connection are discarded by the server,
+    // mails that didn't send any data yet can start over on the next one
+    for (ServerReplyContainer &cont : queue) {
+        if (cont.state != ServerReplyContainer::Initial && !cont.dataSent) {
+            cont.reset();
+        }
+    }
+}
+
+void ServerPrivate::readMailReply()
+{
+    if (queue.isEmpty()) {
+        qCWarning(SIMPLEMAIL_SERVER) << "Unexpected server reply" << replies.lastLine();
+        state = Ready;
+        return;
+    }
+
+    ServerReplyContainer &cont = queue[0];
+    if (!cont.awaiting()) {
+        qCWarning(SIMPLEMAIL_SERVER) << "Unexpected server reply" << replies.lastLine()
+                                     << cont.state;
+        return;
+    }
+
+    // The MAIL reply comes first, followed by one for each RCPT
+    const int rcpt        = cont.awaitedPos - 1;
+    const int awaitedCode = cont.takeAwaited();
+
+    const int code         = parseResponseCode();
+    const bool isRecipient = rcpt >= 0 && rcpt < cont.recipients.size();
+    if (code == 421 || (code == 451 && !isRecipient)) {
+        // A 451 to MAIL or DATA is about the server, to RCPT it's about the mailbox
+        notifyThrottled();
+    }
+
+    bool accepted = code == awaitedCode;
+    if (isRecipient) {
+        ServerReply::RecipientStatus &status = cont.recipients[rcpt];
+        status.code                          = code;
+        status.enhancedStatus                = replies.enhancedStatus();
+        status.text                          = replies.text();
+        // 452 is also used for a full mailbox, which has it's own enhanced status
+        const bool tooManyRecipients =
+            code == 452 && (status.enhancedStatus.isEmpty() ||
+                            status.enhancedStatus == QLatin1String("4.5.3"));
+        if (status.accepted()) {
+            ++cont.acceptedRecipients;
+        } else if (tooManyRecipients && cont.acceptedRecipients > 0) {
+            // RFC 5321 4.5.3.1.10, what was accepted so far is the server limit
+            if (learnedRecipientLimit <= 0 || cont.acceptedRecipients < learnedRecipientLimit) {
+                learnedRecipientLimit = cont.acceptedRecipients;
+                qCDebug(SIMPLEMAIL_SERVER) << "Learned recipients limit" << learnedRecipientLimit;
+            }
+            cont.deferred << rcpt;
+        } else if (isTransient(code) && cont.attempts < maxRetries) {
+            // Greylisting or a temporary problem of the mailbox, tried again later
+            qCDebug(SIMPLEMAIL_SERVER) << "Recipient deferred" << status.address << code;
+            cont.retryRecipients << rcpt;
+        } else {
+            qCDebug(SIMPLEMAIL_SERVER) << "Recipient rejected" << status.address << code;
+        }
+
+        // The mail goes to the accepted recipients, it only fails if none was
+        accepted = cont.acceptedRecipients > 0 || rcpt + 1 < cont.recipients.size();
+    }
+
+    if (!accepted && !cont.failed) {
+        cont.failed    = true;
+        cont.errorCode = code;
+        cont.errorText = QString(replies.text());
+        if (!cont.retryRecipients.isEmpty()) {
+            // Retries the whole mail, as no recipient would get it otherwise
+            const ServerReply::RecipientStatus &status =
+                cont.recipients.at(cont.retryRecipients.first());
+            cont.errorCode = status.code;
+            cont.errorText = status.text;
+        }
+        cont.dotStuffing.reset();
+        cont.stream.reset();
+        if (!hasCap(ServerCapabilities::Pipelining)) {
+            // The remaining commands were never sent
+            cont.dropAwaited();
+        }
+        qCDebug(SIMPLEMAIL_SERVER) << "Mail error" << code << replies.text();
+    }
+
+    if (cont.failed) {
+        if (code == 354 && awaitedCode == 354) {
+            // The server waits for the DATA of a transaction we gave up,
+            // dropping the connection is the only way to not deliver it
+            failMail(cont.errorCode, cont.errorText);
+            socket->disconnectFromHost();
+            return;
+        }
+
+        if (!cont.awaiting()) {
+            failMail(cont.errorCode, cont.errorText);
+            if (!queue.isEmpty() && queue[0].state != ServerReplyContainer::Initial) {
+                // The data was complete so the server already ended this
+                // transaction, the next envelope was pipelined after it
+                processNextMail();
+                return;
+            }
+
+            // All pipelined replies were consumed, reset the transaction
+            state = Ready;
+            commandReset();
+        }
+        return;
+    }
+
+    if (cont.state == ServerReplyContainer::SendingCommands) {
+        if (!hasCap(ServerCapabilities::Pipelining) && cont.awaiting()) {
+            // Write next command, one for each reply received so far
+            socket->write(cont.command(cont.awaitedPos));
+        } else if (!cont.awaiting()) {
+            startData(cont);
+        }
+    } else if (!cont.awaiting() && !cont.stream) {
+        finishMail(false, code, QString(replies.text()));
+        qCDebug(SIMPLEMAIL_SERVER) << "MAIL FINISHED" << code << queue.size();
+
+        processNextMail();
+    } else if (cont.chunking) {
+        // Without PIPELINING the next BDAT chunk waits for this reply
+        pumpData();
+    }
+}
+
+void ServerPrivate::startData(ServerReplyContainer &cont)
+{
+    cont.state = ServerReplyContainer::SendingData;
+    pumpData();
+}
+
+void ServerPrivate::pumpData()
+{
+    if (queue.isEmpty() || !queue[0].stream ||
+        queue[0].state != ServerReplyContainer::SendingData) {
+        return;
+    }
+
+    ServerReplyContainer &cont = queue[0];
+    QIODevice *source          = cont.stream.get();
+    if (cont.dotStuffing) {
+        source = cont.dotStuffing.get();
+    }
+    while (bytesToWrite() < DataWindowSize) {
+        if (cont.chunking && !hasCap(ServerCapabilities::Pipelining) && cont.awaiting()) {
+            return;
+        }
+
+        if (rateLimited(rateLimiter->dataDelay())) {
+            return;
+        }
+
+        dataBuffer.resize(DataChunkSize);
+        const qint64 read = source->read(dataBuffer.data(), DataChunkSize);
+        if (read < 0) {
+            failData();
+            return;
+        }
+        cont.dataSent = true;
+        rateLimiter->consumeData(read);
+
+        if (cont.chunking) {
+            // MimeStream only returns short reads at the end
+            const bool last = read < DataChunkSize;
+            const QByteArray bdat =
+                "BDAT " + QByteArray::number(read) + (last ? " LAST\r\n" : "\r\n");
+            if (socket->write(bdat) != bdat.size() ||
+                socket->write(dataBuffer.constData(), read) != read) {
+                failData();
+                return;
+            }
+            cont.await(250);
+
+            if (last) {
+                cont.dotStuffing.reset();
+                cont.stream.reset();
+                qCDebug(SIMPLEMAIL_SERVER) << "Mail sent";
+                if (messagePipelining && hasCap(ServerCapabilities::Pipelining)) {
+                    pipelineNextMail();
+                }
+                return;
             }
             continue;
         }
 
-        if (responseSize >= 4 && responseText[3] == ' ') {
-            if (responseCode != expectedCode) {
-                const QString lastError = QString::fromLatin1(responseText);
-                qCWarning(SIMPLEMAIL_SERVER)
-                    << "Unexpected server response" << lastError << expectedCode;
-                failConnection(defaultError, responseCode, lastError);
-                return false;
+        if (read > 0 && socket->write(dataBuffer.constData(), read) != read) {
+            failData();
+            return;
+        }
+
+        if (read == 0) {
+            cont.dotStuffing.reset();
+            cont.stream.reset();
+            if (socket->write("\r\n.\r\n", 5) != 5) {
+                failData();
+                return;
             }
-            if (responseMessage) {
-                *responseMessage = responseText.mid(4);
+            cont.await(250);
+            qCDebug(SIMPLEMAIL_SERVER) << "Mail sent";
+            if (messagePipelining && hasCap(ServerCapabilities::Pipelining)) {
+                pipelineNextMail();
             }
-            return true;
+            return;
         }
+    }
+}
 
-        const QString lastError = QString::fromLatin1(responseText);
-        qCWarning(SIMPLEMAIL_SERVER) << "Unexpected server response" << lastError << expectedCode;
-        failConnection(defaultError, responseCode, lastError);
+void ServerPrivate::failData()
+{
+    Q_Q(Server);
+
+    qCCritical(SIMPLEMAIL_SERVER) << "Error writing mail";
+    failMail(-1, q->tr("Error sending mail DATA"));
+    socket->disconnectFromHost();
+}
+
+qint64 ServerPrivate::bytesToWrite() const
+{
+    qint64 ret = socket->bytesToWrite();
+#ifndef QT_NO_SSL
+    // QSslSocket moves data to it's encrypted buffer as soon as it can
+    auto sslSock = qobject_cast<QSslSocket *>(socket);
+    if (sslSock) {
+        ret += sslSock->encryptedBytesToWrite();
+    }
+#endif
+    return ret;
+}
+
+void ServerPrivate::finishMail(bool error, int responseCode, const QString &responseText)
+{
+    // Remove it from the queue first as the finished() handler might send another mail
+    ServerReplyContainer cont = queue.takeFirst();
+    finishShard(cont, error, responseCode, responseText);
+}
+
+void ServerPrivate::finishShard(ServerReplyContainer &cont,
+                                bool error,
+                                int responseCode,
+                                const QString &responseText)
+{
+    ServerReply *reply = cont.reply;
+    if (!reply) {
+        spoolFinished(cont, false);
+        return;
+    }
+
+    if (!error && (!cont.deferred.isEmpty() || !cont.retryRecipients.isEmpty())) {
+        ensureShards(cont);
+    }
+
+    if (error) {
+        for (ServerReply::RecipientStatus &status : cont.recipients) {
+            if (status.accepted()) {
+                // Accepted by a transaction that failed, so it was not delivered
+                status.code = responseCode;
+                status.enhancedStatus.clear();
+                status.text = responseText;
+            }
+        }
+    }
+
+    if (!cont.shards) {
+        spoolFinished(cont, !error);
+        reply->setRecipientStatus(cont.recipients);
+        reply->finish(error, responseCode, responseText);
+        return;
+    }
+
+    EnvelopeShards &shards = *cont.shards;
+    for (int i = 0; i < cont.recipients.size(); ++i) {
+        shards.recipients[cont.recipientIndex.at(i)] = cont.recipients.at(i);
+    }
+
+    if (!error && !cont.deferred.isEmpty()) {
+        // After the mails that are already on their way
+        lanes[cont.priority].insert(0, makeShard(cont, cont.deferred));
+    }
+
+    if (!error && !cont.retryRecipients.isEmpty()) {
+        // Temporary failures are sent again after a backoff, on the same budget as the mail
+        ServerReplyContainer retry = makeShard(cont, cont.retryRecipients);
+        retry.attempts             = cont.attempts + 1;
+        const int delay            = retryBackoff(retry.attempts);
+        qCDebug(SIMPLEMAIL_SERVER) << "Retrying" << cont.retryRecipients.size() << "recipients in"
+                                   << delay << "ms";
+
+        startTicker();
+        retry.retryAt = clock.elapsed() + delay;
+        retryQueue.append(std::move(retry));
+    }
+
+    // The mail is delivered if any of it's transactions was
+    if (!error) {
+        shards.delivered    = true;
+        shards.responseCode = responseCode;
+        shards.responseText = responseText;
+    } else if (!shards.delivered) {
+        shards.responseCode = responseCode;
+        shards.responseText = responseText;
+    }
+
+    if (--shards.pending > 0) {
+        return;
+    }
+
+    shards.stream.reset();
+    spoolFinished(cont, shards.delivered);
+    reply->setRecipientStatus(shards.recipients);
+    reply->finish(!shards.delivered, shards.responseCode, shards.responseText);
+}
+
+void ServerPrivate::failMail(int responseCode, const QString &responseText)
+{
+    if (!retryMail(responseCode)) {
+        finishMail(true, responseCode, responseText);
+    }
+}
+
+bool ServerPrivate::retryMail(int responseCode)
+{
+    ServerReplyContainer &cont = queue.first();
+    if (cont.reply.isNull() || cont.attempts >= maxRetries || !isTransient(responseCode)) {
         return false;
     }
-    return false;
+
+    ++cont.attempts;
+    const int delay = retryBackoff(cont.attempts);
+    qCDebug(SIMPLEMAIL_SERVER) << "Retrying mail in" << delay << "ms, attempt" << cont.attempts
+                               << "failed with" << responseCode;
+
+    startTicker();
+    cont.reset();
+    cont.retryAt = clock.elapsed() + delay;
+    retryQueue.append(queue.takeFirst());
+    return true;
+}
+
+void ServerPrivate::requeueMails(int responseCode, const QString &error)
+{
+    // A server that can't be reached costs the next mail an attempt,
+    // so the queue still drains in bounded time
+    const bool unreachable = !connectionReady;
+    if (unreachable && queue.isEmpty()) {
+        promoteNextMail();
+    }
+
+    // The current mail is the one that failed, the ones behind it that
+    // didn't send any data yet are kept for the next connection
+    RingBuffer<ServerReplyContainer> untouched;
+    const bool started = !queue.isEmpty() && queue[0].state != ServerReplyContainer::Initial;
+    int i              = unreachable || started ? 1 : 0;
+    while (i < queue.size()) {
+        if (!queue[i].dataSent) {
+            queue[i].reset();
+            untouched.append(queue.takeAt(i));
+        } else {
+            ++i;
+        }
+    }
+
+    // These lose an attempt, a mail is retried up to maxRetries
+    while (!queue.isEmpty()) {
+        failMail(responseCode, error);
+    }
+
+    while (!untouched.isEmpty()) {
+        ServerReplyContainer cont = untouched.takeAt(untouched.size() - 1);
+        const int lane            = cont.priority;
+        lanes[lane].insert(0, std::move(cont));
+    }
+
+    if (!hasMail()) {
+        // The retry queue reconnects when it's mails are due
+        return;
+    }
+
+    ++connectFailures;
+    const int delay = retryBackoff(connectFailures);
+    qCDebug(SIMPLEMAIL_SERVER) << "Reconnecting in" << delay << "ms, attempt" << connectFailures;
+
+    startTicker();
+    reconnectAt = clock.elapsed() + delay;
 }
 
-int ServerPrivate::parseResponseCode(QByteArray *responseMessage)
+void ServerPrivate::requeueRetries()
 {
     Q_Q(Server);
 
-    // Save the server's response
-    const QByteArray responseText = socket->readLine().trimmed();
-    qCDebug(SIMPLEMAIL_SERVER) << "Got response" << responseText;
+    const qint64 now = clock.elapsed();
+    bool requeued    = false;
+    int i            = 0;
+    while (i < retryQueue.size()) {
+        const ServerReplyContainer &cont = retryQueue[i];
+        if (isCancelled(cont)) {
+            retryQueue.removeAt(i);
+        } else if (cont.expiry.hasExpired()) {
+            ServerReplyContainer expired = retryQueue.takeAt(i);
+            dropExpired(expired);
+        } else if (cont.retryAt <= now) {
+            // Back in line with the mails of it's priority
+            const int lane = cont.priority;
+            lanes[lane].append(retryQueue.takeAt(i));
+            requeued = true;
+        } else {
+            ++i;
+        }
+    }
+
+    if (!requeued) {
+        return;
+    }
+
+    if (state == Disconnected) {
+        if (reconnectAt < 0) {
+            q->connectToServer();
+        }
+    } else if (state == Ready) {
+        processNextMail();
+        updateDeadline();
+    }
+}
+
+int ServerPrivate::retryBackoff(int attempt) const
+{
+    qint64 delay = retryDelay;
+    for (int i = 1; i < attempt && delay < maxRetryDelay; ++i) {
+        delay *= 2;
+    }
+    delay = qMin<qint64>(delay, maxRetryDelay);
+
+    // Half of it is random so clients that failed together don't come back together
+    const int half = int(delay / 2);
+    return half + int(QRandomGenerator::global()->bounded(half + 1));
+}
 
-    // Extract the respose code from the server's responce (first 3 digits)
-    const int responseCode = responseText.left(3).toInt();
+bool ServerPrivate::isTransient(int responseCode)
+{
+    // Socket errors and timeouts have no reply code, 421 means the service is
+    // closing the connection and 45x are temporary failures, RFC 5321 4.2.5
+    return responseCode == -1 || responseCode == 421 || responseCode / 10 == 45;
+}
+
+void ServerPrivate::notifyThrottled()
+{
+    if (throttled) {
+        throttled();
+    }
+}
+
+bool ServerPrivate::parseResponseCode(int expectedCode, Server::SmtpError defaultError)
+{
+    const int responseCode = replies.code();
+    qCDebug(SIMPLEMAIL_SERVER) << "Got response" << responseCode << "expected" << expectedCode;
+
+    if (responseCode == 421 || (responseCode == 451 && state == WaitingForServiceReady220)) {
+        // The server is closing the session or refuses new ones for now
+        notifyThrottled();
+    }
 
     if (responseCode / 100 == 4) {
-        Q_EMIT q->smtpError(Server::ServerError, QString::fromLatin1(responseText));
+        failConnection(Server::ServerError, responseCode, QString(replies.lastLine()));
+        return false;
     }
 
     if (responseCode / 100 == 5) {
-        Q_EMIT q->smtpError(Server::ClientError, QString::fromLatin1(responseText));
+        failConnection(Server::ClientError, responseCode, QString(replies.lastLine()));
+        return false;
+    }
+
+    if (responseCode != expectedCode) {
+        const QString lastError = QString(replies.lastLine());
+        qCWarning(SIMPLEMAIL_SERVER) << "Unexpected server response" << lastError << expectedCode;
+        failConnection(defaultError, responseCode, lastError);
+        return false;
+    }
+    return true;
+}
+
+int ServerPrivate::parseResponseCode()
+{
+    Q_Q(Server);
+
+    const int responseCode = replies.code();
+    if (responseCode / 100 == 4) {
+        Q_EMIT q->smtpError(Server::ServerError, QString(replies.lastLine()));
     }
 
-    if (responseMessage) {
-        *responseMessage = responseText.mid(4);
+    if (responseCode / 100 == 5) {
+        Q_EMIT q->smtpError(Server::ClientError, QString(replies.lastLine()));
     }
 
     return responseCode;
 }
 
-int ServerPrivate::parseCaps()
+bool ServerPrivate::parseCaps()
 {
     Q_Q(Server);
 
-    // Save the server's response
-    const QByteArray responseText = socket->readLine().trimmed();
-    qCDebug(SIMPLEMAIL_SERVER) << "Got response" << responseText;
-
-    // Extract the respose code from the server's responce (first 3 digits)
-    int responseCode = responseText.left(3).toInt();
-    if (responseCode == 250) {
-        caps.append(QString::fromLatin1(responseText));
-        if (responseText[3] == ' ') {
-            return 1;
-        } else {
-            return 0;
-        }
-    } else {
-        const QString lastError = QString::fromLatin1(responseText);
+    if (replies.code() != 250) {
+        const QString lastError = QString(replies.lastLine());
         qCWarning(SIMPLEMAIL_SERVER) << "Unexpected server caps" << lastError;
         Q_EMIT q->smtpError(Server::ServerError, lastError);
-        return -1;
+        return false;
     }
+
+    QStringList lines;
+    lines.reserve(replies.lineCount());
+    for (int i = 0; i < replies.lineCount(); ++i) {
+        lines.append(QString(replies.line(i)));
+    }
+    capabilities = ServerCapabilities::fromEhloReply(lines);
+    return true;
 }
 
 void ServerPrivate::commandReset()
@@ -686,6 +1940,7 @@ void ServerPrivate::commandReset()
         qCDebug(SIMPLEMAIL_SERVER) << "Sending RESET";
         socket->write("RSET\r\n", 6);
         state = Reset_250;
+        updateDeadline();
     }
 }
 
@@ -695,6 +1950,7 @@ void ServerPrivate::commandNoop()
         qCDebug(SIMPLEMAIL_SERVER) << "Sending NOOP";
         socket->write("NOOP\r\n", 6);
         state = Noop_250;
+        updateDeadline();
     }
 }
 
@@ -710,12 +1966,26 @@ void ServerPrivate::failConnection(Server::SmtpError defaultError,
     Q_Q(Server);
 
     qCDebug(SIMPLEMAIL_SERVER) << "failConnection" << defaultError << responseCode << error;
-    // Call this when the connection should be closed due an error
-    for (auto &mail : queue) {
-        ServerReply *reply = mail.reply;
-        reply->finish(true, responseCode, error);
+    if (isTransient(responseCode)) {
+        // Only the mail on it's way loses an attempt, the others wait for the next connection
+        requeueMails(responseCode, error);
+        socket->close();
+        Q_EMIT q->smtpError(defaultError, error);
+        return;
+    }
+
+    // Call this when the connection should be closed due a permanent error
+    // Mails sent from the finished() handlers go on a new connection
+    RingBuffer<ServerReplyContainer> mails;
+    mails.swap(queue);
+    for (RingBuffer<ServerReplyContainer> &lane : lanes) {
+        while (!lane.isEmpty()) {
+            mails.append(lane.takeFirst());
+        }
+    }
+    for (ServerReplyContainer &mail : mails) {
+        finishShard(mail, true, responseCode, error);
     }
-    queue.clear();
 
     socket->close();
 
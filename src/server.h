@@ -15,8 +15,10 @@
 */
 #pragma once
 
+#include "servercapabilities.h"
 #include "smtpexports.h"
 
+#include <QDeadlineTimer>
 #include <QObject>
 #include <QtNetwork/qtnetwork-config.h>
 
@@ -39,6 +41,7 @@ public:
         AuthPlain,
         AuthLogin,
         AuthCramMd5,
+        AuthAuto, // Cheapest advertised mechanism: PLAIN, then CRAM-MD5, then LOGIN
     };
     Q_ENUM(AuthMethod)
 
@@ -67,6 +70,19 @@ public:
     };
     Q_ENUM(PeerVerificationType)
 
+    enum Priority {
+        HighPriority, // Transactional mails like password resets
+        NormalPriority,
+        LowPriority, // Bulk mails like newsletters
+    };
+    Q_ENUM(Priority)
+
+    struct SendOptions {
+        Priority priority = NormalPriority;
+        // Once it expires the mail is dropped if it wasn't sent yet
+        QDeadlineTimer expiry = QDeadlineTimer(QDeadlineTimer::Forever);
+    };
+
     explicit Server(QObject *parent = nullptr);
     virtual ~Server();
 
@@ -138,9 +154,50 @@ public:
 
     /**
      * Defines the authenticaion method of the SMTP server
+     *
+     * With AuthAuto the mechanism is picked from the ones the server
+     * advertises, the one that succeeds is remembered for the host and
+     * port so that new connections reuse it. If none is advertised the
+     * emails are sent without authenticating.
      */
     void setAuthMethod(AuthMethod method);
 
+    /**
+     * Returns the extensions advertised by the server on the last EHLO,
+     * it's empty until the connection reaches that point.
+     */
+    ServerCapabilities capabilities() const;
+
+    /**
+     * Returns true if the body encoding is negotiated with the server
+     */
+    bool bodyEncodingNegotiation() const;
+
+    /**
+     * Defines if the body encoding should be negotiated with the server,
+     * when it advertises 8BITMIME text parts are sent as 8bit instead of
+     * quoted-printable and with BINARYMIME and CHUNKING every part is sent
+     * without transfer encoding, which saves the base64 overhead.
+     *
+     * Defaults to true.
+     */
+    void setBodyEncodingNegotiation(bool enable);
+
+    /**
+     * Returns true if the envelope of the next queued email is sent
+     * before the reply for the current email data is received
+     */
+    bool messagePipelining() const;
+
+    /**
+     * Defines if the MAIL and RCPT commands of the next queued email should be
+     * written right after the end of the current email data, when the server
+     * supports PIPELINING, saving one round trip per email on a busy queue.
+     *
+     * Defaults to false.
+     */
+    void setMessagePipelining(bool enable);
+
     /**
      * Sends the email async.
      * The email is added to a queue and is processed once
@@ -154,6 +211,45 @@ public:
      */
     ServerReply *sendMail(const MimeMessage &msg);
 
+    /**
+     * Sends the email async with the given options.
+     *
+     * Queued emails are sent from the highest priority first and in order
+     * within the same priority, an email already on it's way is never
+     * interrupted. An email that is still queued when it's expiry runs out
+     * is not sent and it's reply finishes with an error, a retry waiting
+     * for it's backoff is also dropped.
+     */
+    ServerReply *sendMail(const MimeMessage &msg, const SendOptions &options);
+
+    /**
+     * Returns the directory where queued emails are kept, empty if disabled
+     */
+    QString spoolDirectory() const;
+
+    /**
+     * Defines a directory where queued emails are kept until their reply
+     * finishes, so they are not lost if the process dies. Each email is
+     * rendered to disk when sendMail() is called and sent from there, it's
+     * progress is recorded on a journal that is synced to disk in groups
+     * every few milliseconds. Spooled emails are rendered for 7bit transports.
+     *
+     * Must be set before sending, the emails left by a previous process are
+     * only sent once resumeSpool() is called. Returns false if the directory
+     * can't be used, an empty path disables the spool which is the default.
+     */
+    bool setSpoolDirectory(const QString &path);
+
+    /**
+     * Queues again the emails a previous process left unfinished in the
+     * spool directory, in the order they were sent, and returns their replies
+     * which you must delete.
+     *
+     * An email that was being sent when the process stopped might have been
+     * delivered already, it's sent again so no email is lost.
+     */
+    QList<ServerReply *> resumeSpool();
+
     /**
      * Returns the number of emails in queue
      * Can be useful if you create multiple Server instances and
@@ -161,10 +257,179 @@ public:
      */
     int queueSize() const;
 
+    /**
+     * Returns the interval in milliseconds of the NOOP sent on idle connections
+     */
+    int keepAliveInterval() const;
+
+    /**
+     * Defines the interval in milliseconds at which a NOOP is sent while the
+     * connection is idle, so that the server doesn't time it out,
+     * 0 disables it which is the default.
+     */
+    void setKeepAliveInterval(int msec);
+
+    /**
+     * Returns true if idle connections dropped by the server are established again
+     */
+    bool autoReconnect() const;
+
+    /**
+     * Defines if a connection that was dropped while idle should be established
+     * again in the background, so the next email doesn't wait for the connection,
+     * TLS and authentication. A reconnection that fails is not retried until
+     * the next email is sent. Defaults to false.
+     */
+    void setAutoReconnect(bool enable);
+
+    /**
+     * Returns the time in milliseconds the connection may take to be established
+     */
+    int connectTimeout() const;
+
+    /**
+     * Defines the time in milliseconds the TCP connection may take, once it
+     * expires ConnectionTimeoutError is emitted, the next email loses an
+     * attempt and the others wait for a new connection. 0 disables it,
+     * defaults to 30 seconds.
+     */
+    void setConnectTimeout(int msec);
+
+    /**
+     * Returns the time in milliseconds to wait for the server greeting
+     */
+    int greetingTimeout() const;
+
+    /**
+     * Defines the time in milliseconds to wait for the 220 greeting after
+     * connecting, including the handshake of a SslConnection, once it expires
+     * ResponseTimeoutError is emitted. 0 disables it, defaults to 5 minutes
+     * as recommended by RFC 5321.
+     */
+    void setGreetingTimeout(int msec);
+
+    /**
+     * Returns the time in milliseconds to wait for a command reply
+     */
+    int commandTimeout() const;
+
+    /**
+     * Defines the time in milliseconds to wait for the reply of a command,
+     * including the final reply for the email data, once it expires
+     * ResponseTimeoutError is emitted. 0 disables it, defaults to 5 minutes.
+     */
+    void setCommandTimeout(int msec);
+
+    /**
+     * Returns the time in milliseconds sending data may stall
+     */
+    int sendDataTimeout() const;
+
+    /**
+     * Defines the time in milliseconds the socket may go without writing any
+     * data it has queued, once it expires SendDataTimeoutError is emitted.
+     * 0 disables it, defaults to 3 minutes.
+     */
+    void setSendDataTimeout(int msec);
+
+    /**
+     * Returns how many times an email that failed temporarily is sent again
+     */
+    int maxRetries() const;
+
+    /**
+     * Defines how many times an email is sent again after a transient failure,
+     * a 421 or 45x reply, a socket error or a timeout, permanent 5xx replies
+     * always finish the reply right away. A failed connection only costs an
+     * attempt to the email it was sending, or to the next one if it never
+     * got ready, the others wait for a new connection. 0 disables it which
+     * is the default.
+     */
+    void setMaxRetries(int count);
+
+    /**
+     * Returns the delay in milliseconds before the first retry
+     */
+    int retryDelay() const;
+
+    /**
+     * Defines the delay in milliseconds before the first retry, it doubles on
+     * each attempt up to maxRetryDelay() and gets a random jitter so clients
+     * don't come back all at once. Defaults to 1 second.
+     */
+    void setRetryDelay(int msec);
+
+    /**
+     * Returns the maximum delay in milliseconds between retries
+     */
+    int maxRetryDelay() const;
+
+    /**
+     * Defines the maximum delay in milliseconds between retries,
+     * defaults to 5 minutes.
+     */
+    void setMaxRetryDelay(int msec);
+
+    /**
+     * Returns the maximum number of recipients sent in one transaction
+     */
+    int maxRecipients() const;
+
+    /**
+     * Defines the maximum number of recipients sent in one transaction,
+     * an email with more recipients is sent in several transactions that
+     * share the rendered message. When the server refuses a recipient with
+     * 452 too many recipients, the number it accepted becomes the limit and
+     * the refused recipients are sent again on a new transaction.
+     * 0 means no limit other than the server one, which is the default.
+     */
+    void setMaxRecipients(int count);
+
+    /**
+     * Returns the maximum number of emails started per second
+     */
+    double messageRate() const;
+
+    /**
+     * Defines the maximum number of emails started per second,
+     * 0 disables the limit which is the default.
+     */
+    void setMessageRate(double perSecond);
+
+    /**
+     * Returns the maximum number of recipients sent per second
+     */
+    double recipientRate() const;
+
+    /**
+     * Defines the maximum number of recipients sent per second, the recipients
+     * of a large email delay the ones that follow it.
+     * 0 disables the limit which is the default.
+     */
+    void setRecipientRate(double perSecond);
+
+    /**
+     * Returns the maximum number of email bytes written per second
+     */
+    qint64 byteRate() const;
+
+    /**
+     * Defines the maximum number of email bytes written per second,
+     * 0 disables the limit which is the default.
+     *
+     * The limits are enforced with token buckets that hold up to one second
+     * worth of tokens, so the rate is kept on average with bursts of up to
+     * one second.
+     */
+    void setByteRate(qint64 perSecond);
+
     /**
      * Connects to the SMTP server.
      * This is called automatically when an email is sent, and usually SMTP servers
      * timeout the connection after a while.
+     *
+     * Call it at startup to have the connection ready for the first email,
+     * does nothing if already connected.
      */
     void connectToServer();
 
@@ -181,6 +446,21 @@ public:
      * @param errors defines the errors to ignore
      */
     void ignoreSslErrors(const QList<QSslError> &errors);
+
+    /**
+     * Returns the number of TLS handshakes completed by this server
+     */
+    int tlsHandshakeCount() const;
+
+    /**
+     * Returns how many of the TLS handshakes offered a session ticket
+     * cached from a previous connection to the same host and port, with
+     * the same connection type and peer verification, by this or any other
+     * server. Only tickets of sessions that verified the peer without
+     * errors are cached. This is not the number of resumed sessions, the
+     * server may ignore the ticket and Qt doesn't tell if it did.
+     */
+    int tlsSessionOfferCount() const;
 #endif
 
 Q_SIGNALS:
@@ -190,6 +470,8 @@ Q_SIGNALS:
 #endif
 
 private:
+    friend class ServerPoolPrivate;
+
     ServerPrivate *d_ptr;
 };
 
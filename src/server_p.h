@@ -16,16 +16,46 @@
 #ifndef SERVER_P_H
 #define SERVER_P_H
 
+#include "dotstuffingdevice_p.h"
 #include "mimemessage.h"
+#include "mimestream_p.h"
+#include "ratelimiter_p.h"
+#include "replyparser_p.h"
+#include "ringbuffer_p.h"
 #include "server.h"
+#include "serverreply.h"
+#include "spool_p.h"
 
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include <QDeadlineTimer>
+#include <QElapsedTimer>
 #include <QPointer>
 
 class QTcpSocket;
+class QTimer;
 
 namespace SimpleMail {
 
-class ServerReply;
+/**
+ * Shared by the transactions a mail with too many recipients is split into,
+ * the reply finishes once all of them did.
+ */
+class EnvelopeShards
+{
+public:
+    QList<ServerReply::RecipientStatus> recipients;
+    std::shared_ptr<MimeStream> stream;
+    QString responseText;
+    int responseCode                      = 0;
+    int pending                           = 1;
+    MimeStream::BodyEncoding bodyEncoding = MimeStream::SevenBit;
+    bool chunking                         = false;
+    bool delivered                        = false;
+};
+
 class ServerReplyContainer
 {
 public:
@@ -35,16 +65,98 @@ public:
         SendingData,
     };
 
-    ServerReplyContainer(const MimeMessage &email)
+    ServerReplyContainer(const MimeMessage &email, const Server::SendOptions &options = {})
         : msg(email)
+        , expiry(options.expiry)
+        , priority(options.priority)
+    {
+    }
+
+    // Moved around the queues, never copied
+    ServerReplyContainer(ServerReplyContainer &&)                 = default;
+    ServerReplyContainer &operator=(ServerReplyContainer &&)      = default;
+    ServerReplyContainer(const ServerReplyContainer &)            = delete;
+    ServerReplyContainer &operator=(const ServerReplyContainer &) = delete;
+
+    inline void addCommand(const QByteArray &command, int awaitedCode)
+    {
+        commands.append(command);
+        commandEnds.push_back(commands.size());
+        awaitedCodes.push_back(awaitedCode);
+    }
+
+    inline QByteArray command(int index) const
     {
+        const int begin = index > 0 ? commandEnds[size_t(index - 1)] : 0;
+        return QByteArray::fromRawData(commands.constData() + begin,
+                                       commandEnds[size_t(index)] - begin);
+    }
+
+    inline void await(int code) { awaitedCodes.push_back(code); }
+    inline bool awaiting() const { return awaitedPos < int(awaitedCodes.size()); }
+    inline int takeAwaited() { return awaitedCodes[size_t(awaitedPos++)]; }
+
+    // Drops the codes of commands that won't be sent
+    inline void dropAwaited() { awaitedCodes.resize(size_t(awaitedPos)); }
+
+    inline void reset()
+    {
+        state = Initial;
+        commands.clear();
+        commandEnds.clear();
+        awaitedCodes.clear();
+        errorText.clear();
+        stream.reset();
+        dotStuffing.reset();
+        deferred.clear();
+        retryRecipients.clear();
+        // The recipients are kept as a shard only has some of the mail ones
+        for (ServerReply::RecipientStatus &status : recipients) {
+            status.code = 0;
+            status.enhancedStatus.clear();
+            status.text.clear();
+        }
+        errorCode          = 0;
+        awaitedPos         = 0;
+        acceptedRecipients = 0;
+        dataSent           = false;
+        failed             = false;
     }
 
     MimeMessage msg;
     QPointer<ServerReply> reply;
-    QByteArrayList commands;
-    QList<int> awaitedCodes;
-    State state = Initial;
+    std::shared_ptr<MimeStream> stream;
+    // Reads the stream for DATA, BDAT sends it as is
+    std::unique_ptr<DotStuffingDevice> dotStuffing;
+    // Rendered message of a mail resumed from the spool, msg only has the sender
+    std::shared_ptr<QIODevice> spooled;
+    // Envelope commands written back to back, commandEnds has where each one ends
+    QByteArray commands;
+    std::vector<int> commandEnds;
+    // Reply codes in the order they are expected, the ones before awaitedPos arrived
+    std::vector<int> awaitedCodes;
+    QList<ServerReply::RecipientStatus> recipients;
+    // Position of each recipient in the shards list
+    QList<int> recipientIndex;
+    // Recipients refused with 452, sent again on a new transaction
+    QList<int> deferred;
+    // Recipients refused with another temporary failure, sent again after a backoff
+    QList<int> retryRecipients;
+    std::shared_ptr<EnvelopeShards> shards;
+    QString errorText;
+    QDeadlineTimer expiry;
+    quint64 spoolId                       = 0;
+    qint64 retryAt                        = 0;
+    int errorCode                         = 0;
+    int attempts                          = 0;
+    int awaitedPos                        = 0;
+    int acceptedRecipients                = 0;
+    State state                           = Initial;
+    Server::Priority priority             = Server::NormalPriority;
+    MimeStream::BodyEncoding bodyEncoding = MimeStream::SevenBit;
+    bool chunking                         = false;
+    bool dataSent                         = false;
+    bool failed                           = false;
 };
 
 class ServerPrivate
@@ -70,6 +182,18 @@ public:
         SendingMail,
     };
 
+    enum {
+        // Maximum amount of DATA buffered on the socket at once
+        DataWindowSize = 256 * 1024,
+        DataChunkSize  = 64 * 1024,
+        // Delay before an idle connection dropped by the server is established again
+        ReconnectDelay = 1000,
+        // Resolution of the deadlines and keep alive
+        TickInterval = 1000,
+        // Lanes of mails not started yet, one per Server::Priority
+        PriorityCount = Server::LowPriority + 1,
+    };
+
     ServerPrivate(Server *srv)
         : q_ptr(srv)
     {
@@ -77,22 +201,91 @@ public:
     inline void createSocket();
     void setPeerVerificationType(const Server::PeerVerificationType &type);
     void login();
+    Server::AuthMethod selectAuthMethod() const;
+    void rememberAuthMethod();
+    QString cacheKey() const;
+#ifndef QT_NO_SSL
+    void restoreTlsSession();
+    void saveTlsSession();
+    QString tlsCacheKey() const;
+#endif
+    void startQueue();
     void processNextMail();
+    bool hasMail() const;
+    bool promoteNextMail();
+    bool dropExpired(ServerReplyContainer &cont);
+    bool isCancelled(const ServerReplyContainer &cont);
+    inline void spoolFinished(const ServerReplyContainer &cont, bool delivered)
+    {
+        if (spool && cont.spoolId) {
+            spool->finish(cont.spoolId, delivered);
+        }
+    }
+    void startKeepAlive();
+    bool rateLimited(qint64 delay);
+    void updateDeadline();
+    void startTicker();
+    void checkDeadlines();
+    void pipelineNextMail();
+    bool prepareEnvelope(ServerReplyContainer &cont, int &errorCode, QString &errorText);
+    void sendEnvelope(ServerReplyContainer &cont);
+    void resetEnvelopes();
+    void processReply();
+    void readMailReply();
+    void startData(ServerReplyContainer &cont);
+    void pumpData();
+    void failData();
+    qint64 bytesToWrite() const;
+    void finishMail(bool error, int responseCode, const QString &responseText);
+    void finishShard(ServerReplyContainer &cont,
+                     bool error,
+                     int responseCode,
+                     const QString &responseText);
+    static void listRecipients(ServerReplyContainer &cont);
+    void splitEnvelope(int index);
+    static ServerReplyContainer makeShard(const ServerReplyContainer &source,
+                                          const QList<int> &positions);
+    static void ensureShards(ServerReplyContainer &cont);
+    int recipientLimit() const;
+    void failMail(int responseCode, const QString &responseText);
+    bool retryMail(int responseCode);
+    void requeueMails(int responseCode, const QString &error);
+    void requeueRetries();
+    int retryBackoff(int attempt) const;
+    static bool isTransient(int responseCode);
+    void notifyThrottled();
 
-    bool parseResponseCode(int expectedCode,
-                           Server::SmtpError defaultError = Server::ServerError,
-                           QByteArray *responseMessage    = nullptr);
-    int parseResponseCode(QByteArray *responseMessage = nullptr);
-    int parseCaps();
+    bool parseResponseCode(int expectedCode, Server::SmtpError defaultError = Server::ServerError);
+    int parseResponseCode();
+    bool parseCaps();
+    inline bool hasCap(ServerCapabilities::Capability capability) const
+    {
+        return capabilities.has(capability);
+    }
     inline void commandReset();
     inline void commandNoop();
     inline void commandQuit();
     void failConnection(Server::SmtpError defaultError, int responseCode, const QString &error);
 
-    QList<ServerReplyContainer> queue;
+    // Mails on their way, the first is the current transaction and
+    // the envelope of the next one might be pipelined behind it
+    RingBuffer<ServerReplyContainer> queue;
+    // Mails not started yet, one queue per priority
+    RingBuffer<ServerReplyContainer> lanes[PriorityCount];
+    // Mails waiting for their retry backoff to expire
+    RingBuffer<ServerReplyContainer> retryQueue;
+    // Shared by the servers of a pool
+    std::shared_ptr<RateLimiter> rateLimiter = std::make_shared<RateLimiter>();
+    // Called by the pool when the server throttles the connection or times out
+    std::function<void()> throttled;
+    std::unique_ptr<Spool> spool;
     Server *q_ptr;
     QTcpSocket *socket = nullptr;
-    QStringList caps;
+    QTimer *ticker     = nullptr;
+    QElapsedTimer clock;
+    ServerCapabilities capabilities;
+    ReplyParser replies;
+    QByteArray dataBuffer;
     QString host = QStringLiteral("localhost");
     QString hostname;
     QString username;
@@ -100,9 +293,32 @@ public:
     quint16 port                                      = 25;
     Server::ConnectionType connectionType             = Server::TcpConnection;
     Server::AuthMethod authMethod                     = Server::AuthNone;
+    Server::AuthMethod loginMethod                    = Server::AuthNone;
     Server::PeerVerificationType peerVerificationType = Server::VerifyPeer;
     State state                                       = Disconnected;
-    bool capPipelining                                = false;
+    Server::SmtpError deadlineError                   = Server::ResponseTimeoutError;
+    qint64 deadline                                   = -1;
+    qint64 keepAliveAt                                = -1;
+    qint64 reconnectAt                                = -1;
+    qint64 resumeAt                                   = -1;
+    int connectTimeout                                = 30000;
+    int greetingTimeout                               = 300000;
+    int commandTimeout                                = 300000;
+    int dataTimeout                                   = 180000;
+    int keepAliveInterval                             = 0;
+    int maxRetries                                    = 0;
+    int retryDelay                                    = 1000;
+    int maxRetryDelay                                 = 300000;
+    int connectFailures                               = 0;
+    int maxRecipients                                 = 0;
+    int learnedRecipientLimit                         = 0;
+    int tlsHandshakes                                 = 0;
+    int tlsSessionOffers                              = 0;
+    bool bodyEncodingNegotiation                      = true;
+    bool messagePipelining                            = false;
+    bool tlsSessionOffered                            = false;
+    bool autoReconnect                                = false;
+    bool connectionReady                              = false;
 };
 
 } // namespace SimpleMail
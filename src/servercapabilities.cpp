@@ -0,0 +1,149 @@
+/*
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  See the LICENSE file for more details.
+*/
+#include "servercapabilities_p.h"
+
+using namespace SimpleMail;
+
+namespace {
+struct KnownCapability {
+    const char *keyword;
+    ServerCapabilities::Capability capability;
+};
+
+const KnownCapability knownCapabilities[] = {
+    {"PIPELINING", ServerCapabilities::Pipelining},
+    {"CHUNKING", ServerCapabilities::Chunking},
+    {"8BITMIME", ServerCapabilities::EightBitMime},
+    {"BINARYMIME", ServerCapabilities::BinaryMime},
+    {"SMTPUTF8", ServerCapabilities::SmtpUtf8},
+    {"DSN", ServerCapabilities::Dsn},
+    {"ENHANCEDSTATUSCODES", ServerCapabilities::EnhancedStatusCodes},
+    {"STARTTLS", ServerCapabilities::StartTls},
+    {"SIZE", ServerCapabilities::Size},
+    {"AUTH", ServerCapabilities::Auth},
+};
+} // namespace
+
+ServerCapabilities::ServerCapabilities()
+    : d_ptr(new ServerCapabilitiesPrivate)
+{
+}
+
+ServerCapabilities::ServerCapabilities(const ServerCapabilities &other)
+    : d_ptr(other.d_ptr)
+{
+}
+
+ServerCapabilities::~ServerCapabilities()
+{
+}
+
+ServerCapabilities &ServerCapabilities::operator=(const ServerCapabilities &other)
+{
+    d_ptr = other.d_ptr;
+    return *this;
+}
+
+ServerCapabilities ServerCapabilities::fromEhloReply(const QStringList &lines)
+{
+    ServerCapabilities ret;
+    ServerCapabilitiesPrivate *d = ret.d_func();
+    d->parsed                    = true;
+
+    for (int i = 1; i < lines.size(); ++i) {
+        QStringView line = lines.at(i);
+        if (line.size() >= 3 && line.at(0).isDigit() && line.at(1).isDigit() &&
+            line.at(2).isDigit()) {
+            // 250-KEYWORD [params] or 250 KEYWORD [params] on the last line
+            line = line.size() > 4 ? line.mid(4) : QStringView();
+        }
+        line = line.trimmed();
+        if (line.isEmpty()) {
+            continue;
+        }
+        d->extensions.append(line.toString());
+
+        const int space          = int(line.indexOf(QLatin1Char(' ')));
+        QStringView keyword      = space == -1 ? line : line.left(space);
+        const QStringView params = space == -1 ? QStringView() : line.mid(space + 1).trimmed();
+        QStringList mechanisms;
+        if (keyword.startsWith(QLatin1String("AUTH="), Qt::CaseInsensitive)) {
+            // Obsolete form still sent by some servers, "AUTH=LOGIN PLAIN"
+            mechanisms << keyword.mid(5).toString();
+            keyword = keyword.left(4);
+        }
+
+        for (const KnownCapability &known : knownCapabilities) {
+            if (keyword.compare(QLatin1String(known.keyword), Qt::CaseInsensitive) == 0) {
+                d->flags |= known.capability;
+                break;
+            }
+        }
+
+        if (keyword.compare(QLatin1String("SIZE"), Qt::CaseInsensitive) == 0) {
+            d->sizeLimit = params.toString().toLongLong();
+        } else if (keyword.compare(QLatin1String("AUTH"), Qt::CaseInsensitive) == 0) {
+            mechanisms << params.toString().split(QLatin1Char(' '), Qt::SkipEmptyParts);
+            for (const QString &mechanism : qAsConst(mechanisms)) {
+                const QString upper = mechanism.toUpper();
+                if (!upper.isEmpty() && !d->authMechanisms.contains(upper)) {
+                    d->authMechanisms.append(upper);
+                }
+            }
+        }
+    }
+
+    return ret;
+}
+
+bool ServerCapabilities::isEmpty() const
+{
+    Q_D(const ServerCapabilities);
+    return !d->parsed;
+}
+
+ServerCapabilities::Capabilities ServerCapabilities::flags() const
+{
+    Q_D(const ServerCapabilities);
+    return d->flags;
+}
+
+bool ServerCapabilities::has(Capability capability) const
+{
+    Q_D(const ServerCapabilities);
+    return d->flags.testFlag(capability);
+}
+
+qint64 ServerCapabilities::sizeLimit() const
+{
+    Q_D(const ServerCapabilities);
+    return d->sizeLimit;
+}
+
+QStringList ServerCapabilities::authMechanisms() const
+{
+    Q_D(const ServerCapabilities);
+    return d->authMechanisms;
+}
+
+QStringList ServerCapabilities::extensions() const
+{
+    Q_D(const ServerCapabilities);
+    return d->extensions;
+}
+
+ServerCapabilitiesPrivate *ServerCapabilities::d_func()
+{
+    return d_ptr.data();
+}
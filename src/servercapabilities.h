@@ -0,0 +1,90 @@
+/*
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  See the LICENSE file for more details.
+*/
+#pragma once
+
+#include "smtpexports.h"
+
+#include <QStringList>
+#include <QtCore/QSharedDataPointer>
+
+namespace SimpleMail {
+
+class ServerCapabilitiesPrivate;
+class SMTP_EXPORT ServerCapabilities
+{
+public:
+    enum Capability {
+        NoCapability        = 0x000,
+        Pipelining          = 0x001, // RFC 2920
+        Chunking            = 0x002, // RFC 3030 BDAT
+        EightBitMime        = 0x004, // RFC 6152
+        BinaryMime          = 0x008, // RFC 3030
+        SmtpUtf8            = 0x010, // RFC 6531
+        Dsn                 = 0x020, // RFC 3461
+        EnhancedStatusCodes = 0x040, // RFC 2034
+        StartTls            = 0x080, // RFC 3207
+        Size                = 0x100, // RFC 1870
+        Auth                = 0x200, // RFC 4954
+    };
+    Q_DECLARE_FLAGS(Capabilities, Capability)
+
+    ServerCapabilities();
+    ServerCapabilities(const ServerCapabilities &other);
+    virtual ~ServerCapabilities();
+
+    ServerCapabilities &operator=(const ServerCapabilities &other);
+
+    /**
+     * Parses the lines of an EHLO reply, with or without the reply code,
+     * the first line is the server greeting and is skipped.
+     */
+    static ServerCapabilities fromEhloReply(const QStringList &lines);
+
+    /**
+     * Returns true if no EHLO reply was parsed
+     */
+    bool isEmpty() const;
+
+    Capabilities flags() const;
+    bool has(Capability capability) const;
+
+    /**
+     * Returns the maximum message size accepted by the server,
+     * 0 if it has no fixed limit or doesn't advertise SIZE.
+     */
+    qint64 sizeLimit() const;
+
+    /**
+     * Returns the SASL mechanisms advertised with AUTH, in upper case
+     */
+    QStringList authMechanisms() const;
+
+    /**
+     * Returns all advertised extensions without the reply code,
+     * including the ones without a flag, like "SIZE 35882577"
+     */
+    QStringList extensions() const;
+
+protected:
+    QSharedDataPointer<ServerCapabilitiesPrivate> d_ptr;
+
+private:
+    // Q_DECLARE_PRIVATE equivalent for shared data pointers
+    ServerCapabilitiesPrivate *d_func();
+    inline const ServerCapabilitiesPrivate *d_func() const { return d_ptr.constData(); }
+};
+
+} // namespace SimpleMail
+
+Q_DECLARE_OPERATORS_FOR_FLAGS(SimpleMail::ServerCapabilities::Capabilities)
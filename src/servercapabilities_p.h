@@ -0,0 +1,33 @@
+/*
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  See the LICENSE file for more details.
+*/
+#ifndef SERVERCAPABILITIES_P_H
+#define SERVERCAPABILITIES_P_H
+
+#include "servercapabilities.h"
+
+namespace SimpleMail {
+
+class ServerCapabilitiesPrivate : public QSharedData
+{
+public:
+    QStringList extensions;
+    QStringList authMechanisms;
+    qint64 sizeLimit                       = 0;
+    ServerCapabilities::Capabilities flags = ServerCapabilities::NoCapability;
+    bool parsed                            = false;
+};
+
+} // namespace SimpleMail
+
+#endif // SERVERCAPABILITIES_P_H
@@ -0,0 +1,384 @@
+/*
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  See the LICENSE file for more details.
+*/
+#include "server_p.h"
+#include "serverpool_p.h"
+#include "serverreply.h"
+
+#include <QHostInfo>
+#include <QLoggingCategory>
+
+Q_LOGGING_CATEGORY(SIMPLEMAIL_SERVERPOOL, "simplemail.serverpool", QtInfoMsg)
+
+using namespace SimpleMail;
+
+ServerPool::ServerPool(QObject *parent)
+    : QObject(parent)
+    , d_ptr(new ServerPoolPrivate(this))
+{
+    Q_D(ServerPool);
+    d->hostname = QHostInfo::localHostName();
+}
+
+ServerPool::~ServerPool()
+{
+    delete d_ptr;
+}
+
+QString ServerPool::host() const
+{
+    Q_D(const ServerPool);
+    return d->host;
+}
+
+void ServerPool::setHost(const QString &host)
+{
+    Q_D(ServerPool);
+    d->host = host;
+    for (Server *server : qAsConst(d->servers)) {
+        server->setHost(host);
+    }
+}
+
+quint16 ServerPool::port() const
+{
+    Q_D(const ServerPool);
+    return d->port;
+}
+
+void ServerPool::setPort(quint16 port)
+{
+    Q_D(ServerPool);
+    d->port = port;
+    for (Server *server : qAsConst(d->servers)) {
+        server->setPort(port);
+    }
+}
+
+QString ServerPool::hostname() const
+{
+    Q_D(const ServerPool);
+    return d->hostname;
+}
+
+void ServerPool::setHostname(const QString &hostname)
+{
+    Q_D(ServerPool);
+    d->hostname = hostname;
+    for (Server *server : qAsConst(d->servers)) {
+        server->setHostname(hostname);
+    }
+}
+
+Server::ConnectionType ServerPool::connectionType() const
+{
+    Q_D(const ServerPool);
+    return d->connectionType;
+}
+
+void ServerPool::setConnectionType(Server::ConnectionType ct)
+{
+    Q_D(ServerPool);
+    d->connectionType = ct;
+    for (Server *server : qAsConst(d->servers)) {
+        server->setConnectionType(ct);
+    }
+}
+
+QString ServerPool::username() const
+{
+    Q_D(const ServerPool);
+    return d->username;
+}
+
+void ServerPool::setUsername(const QString &username)
+{
+    Q_D(ServerPool);
+    if (d->authMethod == Server::AuthNone) {
+        d->authMethod = Server::AuthPlain;
+    }
+    d->username = username;
+    for (Server *server : qAsConst(d->servers)) {
+        server->setUsername(username);
+        server->setAuthMethod(d->authMethod);
+    }
+}
+
+QString ServerPool::password() const
+{
+    Q_D(const ServerPool);
+    return d->password;
+}
+
+void ServerPool::setPassword(const QString &password)
+{
+    Q_D(ServerPool);
+    d->password = password;
+    for (Server *server : qAsConst(d->servers)) {
+        server->setPassword(password);
+    }
+}
+
+Server::AuthMethod ServerPool::authMethod() const
+{
+    Q_D(const ServerPool);
+    return d->authMethod;
+}
+
+void ServerPool::setAuthMethod(Server::AuthMethod method)
+{
+    Q_D(ServerPool);
+    d->authMethod = method;
+    for (Server *server : qAsConst(d->servers)) {
+        server->setAuthMethod(method);
+    }
+}
+
+int ServerPool::keepAliveInterval() const
+{
+    Q_D(const ServerPool);
+    return d->keepAliveInterval;
+}
+
+void ServerPool::setKeepAliveInterval(int msec)
+{
+    Q_D(ServerPool);
+    d->keepAliveInterval = msec;
+    for (Server *server : qAsConst(d->servers)) {
+        server->setKeepAliveInterval(msec);
+    }
+}
+
+bool ServerPool::autoReconnect() const
+{
+    Q_D(const ServerPool);
+    return d->autoReconnect;
+}
+
+void ServerPool::setAutoReconnect(bool enable)
+{
+    Q_D(ServerPool);
+    d->autoReconnect = enable;
+    for (Server *server : qAsConst(d->servers)) {
+        server->setAutoReconnect(enable);
+    }
+}
+
+int ServerPool::maxConnections() const
+{
+    Q_D(const ServerPool);
+    return d->maxConnections;
+}
+
+void ServerPool::setMaxConnections(int max)
+{
+    Q_D(ServerPool);
+    d->maxConnections = qMax(1, max);
+}
+
+void ServerPool::preconnect(int count)
+{
+    Q_D(ServerPool);
+
+    count = qMin(count, d->maxConnections);
+    while (d->servers.size() < count) {
+        d->createServer();
+    }
+
+    for (int i = 0; i < count; ++i) {
+        d->servers.at(i)->connectToServer();
+    }
+}
+
+bool ServerPool::adaptiveConcurrency() const
+{
+    Q_D(const ServerPool);
+    return d->adaptiveConcurrency;
+}
+
+void ServerPool::setAdaptiveConcurrency(bool enable)
+{
+    Q_D(ServerPool);
+    d->adaptiveConcurrency = enable;
+    d->window              = 1;
+}
+
+int ServerPool::concurrencyLimit() const
+{
+    Q_D(const ServerPool);
+    return d->concurrencyLimit();
+}
+
+double ServerPool::messageRate() const
+{
+    Q_D(const ServerPool);
+    return d->rateLimiter->messages.rate();
+}
+
+void ServerPool::setMessageRate(double perSecond)
+{
+    Q_D(ServerPool);
+    d->rateLimiter->messages.setRate(perSecond);
+}
+
+double ServerPool::recipientRate() const
+{
+    Q_D(const ServerPool);
+    return d->rateLimiter->recipients.rate();
+}
+
+void ServerPool::setRecipientRate(double perSecond)
+{
+    Q_D(ServerPool);
+    d->rateLimiter->recipients.setRate(perSecond);
+}
+
+qint64 ServerPool::byteRate() const
+{
+    Q_D(const ServerPool);
+    return qint64(d->rateLimiter->bytes.rate());
+}
+
+void ServerPool::setByteRate(qint64 perSecond)
+{
+    Q_D(ServerPool);
+    d->rateLimiter->bytes.setRate(double(perSecond));
+}
+
+ServerReply *ServerPool::sendMail(const MimeMessage &msg)
+{
+    return sendMail(msg, Server::SendOptions());
+}
+
+ServerReply *ServerPool::sendMail(const MimeMessage &msg, const Server::SendOptions &options)
+{
+    Q_D(ServerPool);
+
+    Server *server     = d->leastLoadedServer();
+    ServerReply *reply = server->sendMail(msg, options);
+    connect(reply, &ServerReply::finished, this, [d, reply] {
+        if (reply->error()) {
+            ++d->failed;
+        } else {
+            ++d->sent;
+            // Additive increase, one more session per window of emails sent
+            d->window = qMin(double(d->maxConnections), d->window + 1 / d->window);
+        }
+    });
+
+    return reply;
+}
+
+QList<Server *> ServerPool::servers() const
+{
+    Q_D(const ServerPool);
+    return d->servers;
+}
+
+int ServerPool::connectionCount() const
+{
+    Q_D(const ServerPool);
+    return d->servers.size();
+}
+
+int ServerPool::queueSize() const
+{
+    Q_D(const ServerPool);
+    int ret = 0;
+    for (const Server *server : d->servers) {
+        ret += server->queueSize();
+    }
+    return ret;
+}
+
+quint64 ServerPool::sentCount() const
+{
+    Q_D(const ServerPool);
+    return d->sent;
+}
+
+quint64 ServerPool::failedCount() const
+{
+    Q_D(const ServerPool);
+    return d->failed;
+}
+
+Server *ServerPoolPrivate::createServer()
+{
+    Q_Q(ServerPool);
+
+    auto server = new Server(q);
+    server->setHost(host);
+    server->setPort(port);
+    server->setHostname(hostname);
+    server->setConnectionType(connectionType);
+    if (!username.isEmpty()) {
+        server->setUsername(username);
+    }
+    server->setPassword(password);
+    server->setAuthMethod(authMethod);
+    server->setKeepAliveInterval(keepAliveInterval);
+    server->setAutoReconnect(autoReconnect);
+    // The rates are for the pool as a whole
+    server->d_func()->rateLimiter = rateLimiter;
+
+    // Rejected recipients are not a reason to back off, only a busy server is
+    server->d_func()->throttled = [this] {
+        // Multiplicative decrease, the server is throttling or overloaded
+        window = qMax(1.0, window / 2);
+        qCDebug(SIMPLEMAIL_SERVERPOOL) << "Server busy, using" << concurrencyLimit() << "sessions";
+    };
+    q->connect(server, &Server::smtpError, q, &ServerPool::smtpError);
+
+    servers.append(server);
+    qCDebug(SIMPLEMAIL_SERVERPOOL) << "Created session" << servers.size() << "to" << host << port;
+
+    Q_EMIT q->serverCreated(server);
+
+    return server;
+}
+
+Server *ServerPoolPrivate::leastLoadedServer()
+{
+    const int limit = concurrencyLimit();
+    Server *ret     = nullptr;
+    int load        = 0;
+    for (int i = 0; i < qMin(limit, servers.size()); ++i) {
+        Server *server = servers.at(i);
+        const int size = server->queueSize();
+        if (!ret || size < load) {
+            ret  = server;
+            load = size;
+            if (load == 0) {
+                break;
+            }
+        }
+    }
+
+    // Only open a new session when all the existing ones are busy
+    if (!ret || (load > 0 && servers.size() < limit)) {
+        ret = createServer();
+    }
+
+    return ret;
+}
+
+int ServerPoolPrivate::concurrencyLimit() const
+{
+    if (!adaptiveConcurrency) {
+        return maxConnections;
+    }
+    return qBound(1, int(window), maxConnections);
+}
+
+#include "moc_serverpool.cpp"
@@ -0,0 +1,246 @@
+/*
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  See the LICENSE file for more details.
+*/
+#pragma once
+
+#include "server.h"
+#include "smtpexports.h"
+
+#include <QObject>
+
+namespace SimpleMail {
+
+class MimeMessage;
+class ServerReply;
+class ServerPoolPrivate;
+class SMTP_EXPORT ServerPool : public QObject
+{
+    Q_OBJECT
+    Q_DECLARE_PRIVATE(ServerPool)
+public:
+    explicit ServerPool(QObject *parent = nullptr);
+    virtual ~ServerPool();
+
+    /**
+     * Returns the hostname of the SMTP server shared by all sessions
+     */
+    QString host() const;
+
+    /**
+     * Defines the hostname of the SMTP server shared by all sessions
+     */
+    void setHost(const QString &host);
+
+    /**
+     * Returns the port of the SMTP server
+     */
+    quint16 port() const;
+
+    /**
+     * Defines the port of the SMTP server
+     */
+    void setPort(quint16 port);
+
+    /**
+     * The hostname is sent by the EHLO command.
+     */
+    QString hostname() const;
+
+    /**
+     * Defines the client's hostname sent by the EHLO command of every session.
+     * Defaults to the local hostname
+     */
+    void setHostname(const QString &hostname);
+
+    /**
+     * Returns the connection type of the SMTP server
+     */
+    Server::ConnectionType connectionType() const;
+
+    /**
+     * Defines the connection type of the SMTP server
+     */
+    void setConnectionType(Server::ConnectionType ct);
+
+    /**
+     * Returns the username that will authenticate on the SMTP server
+     */
+    QString username() const;
+
+    /**
+     * Defines the username that will authenticate on the SMTP server
+     */
+    void setUsername(const QString &username);
+
+    /**
+     * Returns the password that will authenticate on the SMTP server
+     */
+    QString password() const;
+
+    /**
+     * Defines the password that will authenticate on the SMTP server
+     */
+    void setPassword(const QString &password);
+
+    /**
+     * Returns the authenticaion method of the SMTP server
+     */
+    Server::AuthMethod authMethod() const;
+
+    /**
+     * Defines the authenticaion method of the SMTP server
+     */
+    void setAuthMethod(Server::AuthMethod method);
+
+    /**
+     * Returns the interval in milliseconds of the NOOP sent on idle sessions
+     */
+    int keepAliveInterval() const;
+
+    /**
+     * Defines the keep alive interval of every session, see Server::setKeepAliveInterval()
+     */
+    void setKeepAliveInterval(int msec);
+
+    /**
+     * Returns true if idle sessions dropped by the server are established again
+     */
+    bool autoReconnect() const;
+
+    /**
+     * Defines if sessions reconnect when dropped while idle, see Server::setAutoReconnect()
+     */
+    void setAutoReconnect(bool enable);
+
+    /**
+     * Returns the maximum number of concurrent sessions, defaults to 4
+     */
+    int maxConnections() const;
+
+    /**
+     * Defines the maximum number of concurrent sessions opened to the server.
+     * Sessions are created on demand, a new one is only opened once all
+     * existing sessions have emails in their queues.
+     */
+    void setMaxConnections(int max);
+
+    /**
+     * Opens \p count sessions right away, limited by maxConnections(),
+     * so that the first emails don't wait for the connections to be established.
+     */
+    void preconnect(int count);
+
+    /**
+     * Returns true if the number of sessions used adapts to the server
+     */
+    bool adaptiveConcurrency() const;
+
+    /**
+     * Defines if the number of sessions emails are distributed to adapts to
+     * the server, it starts with one, grows by one after a window of emails
+     * sent without error up to maxConnections() and is halved when the server
+     * throttles the connection with a 421, a 451 not related to a recipient,
+     * or times out. Defaults to false.
+     */
+    void setAdaptiveConcurrency(bool enable);
+
+    /**
+     * Returns the number of sessions emails are currently distributed to
+     */
+    int concurrencyLimit() const;
+
+    /**
+     * Returns the maximum number of emails started per second by all sessions
+     */
+    double messageRate() const;
+
+    /**
+     * Defines the maximum number of emails started per second by all sessions
+     * together, see Server::setMessageRate()
+     */
+    void setMessageRate(double perSecond);
+
+    /**
+     * Returns the maximum number of recipients sent per second by all sessions
+     */
+    double recipientRate() const;
+
+    /**
+     * Defines the maximum number of recipients sent per second by all sessions
+     * together, see Server::setRecipientRate()
+     */
+    void setRecipientRate(double perSecond);
+
+    /**
+     * Returns the maximum number of email bytes written per second by all sessions
+     */
+    qint64 byteRate() const;
+
+    /**
+     * Defines the maximum number of email bytes written per second by all sessions
+     * together, see Server::setByteRate()
+     */
+    void setByteRate(qint64 perSecond);
+
+    /**
+     * Sends the email async using the least loaded session.
+     *
+     * You must delete the returned object, if you do so before
+     * it's finished() signal is emited the email won't be sent.
+     */
+    ServerReply *sendMail(const MimeMessage &msg);
+
+    /**
+     * Sends the email async with the given options using the least
+     * loaded session, see Server::sendMail()
+     */
+    ServerReply *sendMail(const MimeMessage &msg, const Server::SendOptions &options);
+
+    /**
+     * Returns the sessions currently held by the pool
+     */
+    QList<Server *> servers() const;
+
+    /**
+     * Returns the number of sessions currently held by the pool
+     */
+    int connectionCount() const;
+
+    /**
+     * Returns the number of emails in queue on all sessions
+     */
+    int queueSize() const;
+
+    /**
+     * Returns the number of emails successfully sent by the pool
+     */
+    quint64 sentCount() const;
+
+    /**
+     * Returns the number of emails that failed to be sent by the pool
+     */
+    quint64 failedCount() const;
+
+Q_SIGNALS:
+    /**
+     * Emitted when a new session is created, connect to it in order to
+     * handle per session signals like Server::sslErrors().
+     */
+    void serverCreated(SimpleMail::Server *server);
+    void smtpError(SimpleMail::Server::SmtpError e, const QString &description);
+
+private:
+    ServerPoolPrivate *d_ptr;
+};
+
+} // namespace SimpleMail
@@ -0,0 +1,59 @@
+/*
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  See the LICENSE file for more details.
+*/
+#ifndef SERVERPOOL_P_H
+#define SERVERPOOL_P_H
+
+#include "ratelimiter_p.h"
+#include "serverpool.h"
+
+#include <memory>
+
+namespace SimpleMail {
+
+class ServerPoolPrivate
+{
+    Q_DECLARE_PUBLIC(ServerPool)
+public:
+    ServerPoolPrivate(ServerPool *pool)
+        : q_ptr(pool)
+    {
+    }
+
+    Server *createServer();
+    Server *leastLoadedServer();
+    int concurrencyLimit() const;
+
+    QList<Server *> servers;
+    std::shared_ptr<RateLimiter> rateLimiter = std::make_shared<RateLimiter>();
+    ServerPool *q_ptr;
+    QString host = QStringLiteral("localhost");
+    QString hostname;
+    QString username;
+    QString password;
+    quint64 sent                          = 0;
+    quint64 failed                        = 0;
+    // AIMD congestion window, in sessions
+    double window                         = 1;
+    int maxConnections                    = 4;
+    int keepAliveInterval                 = 0;
+    quint16 port                          = 25;
+    Server::ConnectionType connectionType = Server::TcpConnection;
+    Server::AuthMethod authMethod         = Server::AuthNone;
+    bool autoReconnect                    = false;
+    bool adaptiveConcurrency              = false;
+};
+
+} // namespace SimpleMail
+
+#endif // SERVERPOOL_P_H
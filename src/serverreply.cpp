@@ -48,6 +48,18 @@ QString ServerReply::responseText() const
     return d->responseText;
 }
 
+QList<ServerReply::RecipientStatus> ServerReply::recipientStatus() const
+{
+    Q_D(const ServerReply);
+    return d->recipients;
+}
+
+void ServerReply::setRecipientStatus(const QList<RecipientStatus> &status)
+{
+    Q_D(ServerReply);
+    d->recipients = status;
+}
+
 void ServerReply::finish(bool error, int responseCode, const QString &responseText)
 {
     Q_D(ServerReply);
@@ -27,6 +27,19 @@ class SMTP_EXPORT ServerReply : public QObject
     Q_OBJECT
     Q_DECLARE_PRIVATE(ServerReply)
 public:
+    /**
+     * The server reply to the RCPT command of a recipient
+     */
+    struct RecipientStatus {
+        QString address;
+        // RFC 3463 enhanced status code like 5.1.1, empty if not sent
+        QString enhancedStatus;
+        QString text;
+        int code = 0;
+
+        inline bool accepted() const { return code / 100 == 2; }
+    };
+
     explicit ServerReply(QObject *parent = nullptr);
     virtual ~ServerReply();
 
@@ -35,14 +48,25 @@ public:
     int responseCode() const;
     QString responseText() const;
 
+    /**
+     * Returns the RCPT reply of each To, Cc and Bcc recipient in that order.
+     *
+     * The email is sent to the recipients the server accepted, the ones it
+     * rejected are only reported here, so a reply without error() might still
+     * have rejected recipients. It's only an error if all were rejected.
+     */
+    QList<RecipientStatus> recipientStatus() const;
+
 Q_SIGNALS:
     void finished();
 
 protected:
     void finish(bool error, int responseCode, const QString &responseText);
+    void setRecipientStatus(const QList<RecipientStatus> &status);
 
 private:
     friend class ServerPrivate;
+    friend class ThreadedSenderWorker;
 
     ServerReplyPrivate *d_ptr;
 };
@@ -1,6 +1,8 @@
 #ifndef SERVERREPLY_P_H
 #define SERVERREPLY_P_H
 
+#include "serverreply.h"
+
 #include <QString>
 
 namespace SimpleMail {
@@ -8,6 +10,7 @@ namespace SimpleMail {
 class ServerReplyPrivate
 {
 public:
+    QList<ServerReply::RecipientStatus> recipients;
     QString responseText;
     int responseCode = 0;
     bool error       = false;
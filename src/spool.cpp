@@ -0,0 +1,455 @@
+/*
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  See the LICENSE file for more details.
+*/
+#include "spool_p.h"
+
+#include "mimemessage.h"
+#include "mimestream_p.h"
+
+#include <algorithm>
+
+#include <QDir>
+#include <QFileInfo>
+#include <QLoggingCategory>
+#include <QSaveFile>
+#include <QUrl>
+
+#if defined(Q_OS_WIN)
+#include <io.h>
+#elif defined(Q_OS_UNIX)
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+Q_LOGGING_CATEGORY(SIMPLEMAIL_SPOOL, "simplemail.spool", QtInfoMsg)
+
+using namespace SimpleMail;
+
+SpoolMessageDevice::SpoolMessageDevice(const QString &fileName, qint64 offset, qint64 length)
+    : m_file(fileName)
+    , m_offset(offset)
+    , m_length(length)
+{
+}
+
+bool SpoolMessageDevice::open(OpenMode mode)
+{
+    if ((mode & QIODevice::WriteOnly) || !m_file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+    // Unbuffered so pos() is where readData() must read from
+    return QIODevice::open(mode | QIODevice::Unbuffered);
+}
+
+void SpoolMessageDevice::close()
+{
+    QIODevice::close();
+    m_file.close();
+}
+
+qint64 SpoolMessageDevice::size() const
+{
+    return m_length;
+}
+
+qint64 SpoolMessageDevice::readData(char *data, qint64 maxSize)
+{
+    const qint64 size = qMin(maxSize, m_length - pos());
+    if (size <= 0) {
+        return 0;
+    }
+
+    if (!m_file.seek(m_offset + pos())) {
+        return -1;
+    }
+    return m_file.read(data, size);
+}
+
+qint64 SpoolMessageDevice::writeData(const char *data, qint64 len)
+{
+    Q_UNUSED(data)
+    Q_UNUSED(len)
+    return -1;
+}
+
+Spool::Spool()
+{
+    m_commitTimer.setSingleShot(true);
+    m_commitTimer.setInterval(CommitInterval);
+    QObject::connect(&m_commitTimer, &QTimer::timeout, [this] { commit(); });
+}
+
+Spool::~Spool()
+{
+    commit();
+}
+
+bool Spool::open(const QString &path)
+{
+    QDir dir(path);
+    if (!dir.mkpath(QStringLiteral("."))) {
+        qCWarning(SIMPLEMAIL_SPOOL) << "Failed to create spool directory" << path;
+        return false;
+    }
+    m_path = dir.absolutePath();
+
+    QHash<quint64, Entry> entries;
+    m_journal.setFileName(dir.filePath(QStringLiteral("journal")));
+    if (m_journal.open(QIODevice::ReadOnly)) {
+        while (true) {
+            QByteArray line = m_journal.readLine();
+            if (!line.endsWith('\n')) {
+                // End of the journal, or a record cut by a crash
+                break;
+            }
+
+            line.chop(1);
+            if (!parseRecord(line, entries)) {
+                qCWarning(SIMPLEMAIL_SPOOL) << "Ignoring invalid journal record" << line;
+            }
+        }
+        m_journal.close();
+    }
+
+    const QStringList segments =
+        dir.entryList({QStringLiteral("*.seg")}, QDir::Files, QDir::Name);
+    for (const QString &fileName : segments) {
+        const int segment = fileName.section(QLatin1Char('.'), 0, 0).toInt();
+        m_currentSegment  = qMax(m_currentSegment, segment);
+    }
+
+    for (const Entry &entry : qAsConst(entries)) {
+        const QFileInfo segment(segmentPath(entry.segment));
+        if (!segment.exists() || segment.size() < entry.offset + entry.length) {
+            qCWarning(SIMPLEMAIL_SPOOL) << "Dropping mail" << entry.id << "with missing data";
+            continue;
+        }
+
+        m_recovered.push_back(entry);
+        m_live.insert(entry.id, entry.segment);
+        ++m_segmentRefs[entry.segment];
+        m_nextId = qMax(m_nextId, entry.id + 1);
+    }
+    std::sort(m_recovered.begin(), m_recovered.end(), [](const Entry &a, const Entry &b) {
+        return a.id < b.id;
+    });
+
+    // New mails go to a new segment, the tail of the last one might be garbage
+    ++m_currentSegment;
+    for (const QString &fileName : segments) {
+        const int segment = fileName.section(QLatin1Char('.'), 0, 0).toInt();
+        if (!m_segmentRefs.contains(segment)) {
+            QFile::remove(dir.filePath(fileName));
+        }
+    }
+
+    // Compacts the journal to the unfinished mails
+    QSaveFile journal(m_journal.fileName());
+    if (!journal.open(QIODevice::WriteOnly)) {
+        qCWarning(SIMPLEMAIL_SPOOL) << "Failed to write journal" << journal.errorString();
+        return false;
+    }
+    for (const Entry &entry : m_recovered) {
+        journal.write(queuedRecord(entry));
+        if (entry.inFlight) {
+            journal.write("I " + QByteArray::number(entry.id) + '\n');
+        }
+    }
+    if (!journal.commit()) {
+        qCWarning(SIMPLEMAIL_SPOOL) << "Failed to write journal" << journal.errorString();
+        return false;
+    }
+    syncDirectory();
+
+    if (!m_journal.open(QIODevice::WriteOnly | QIODevice::Append)) {
+        qCWarning(SIMPLEMAIL_SPOOL) << "Failed to open journal" << m_journal.errorString();
+        return false;
+    }
+
+    qCDebug(SIMPLEMAIL_SPOOL) << "Spool opened" << m_path << "with" << m_recovered.size()
+                              << "unfinished mails";
+    return true;
+}
+
+Spool::Entry Spool::enqueue(const MimeMessage &msg,
+                            const QStringList &recipients,
+                            int priority,
+                            qint64 expiry)
+{
+    if (m_segment.isOpen() && m_segment.pos() >= SegmentSize) {
+        closeSegment();
+    }
+
+    if (!m_segment.isOpen() && !openSegment()) {
+        return Entry();
+    }
+
+    // Dot-stuffing depends on the transfer, so it's applied when the mail is sent
+    MimeStream stream;
+    if (!msg.write(&stream)) {
+        return Entry();
+    }
+
+    Entry entry;
+    entry.id         = m_nextId;
+    entry.expiry     = expiry;
+    entry.offset     = m_segment.pos();
+    entry.segment    = m_currentSegment;
+    entry.priority   = priority;
+    entry.sender     = msg.sender().address();
+    entry.recipients = recipients;
+
+    char block[16 * 1024];
+    qint64 in;
+    while ((in = stream.read(block, sizeof(block))) > 0) {
+        if (m_segment.write(block, in) != in) {
+            qCWarning(SIMPLEMAIL_SPOOL) << "Failed to write segment" << m_segment.errorString();
+            return Entry();
+        }
+        entry.length += in;
+    }
+    m_segmentDirty = true;
+
+    // Handed to the OS so message() can read it back right away
+    if (in < 0 || !m_segment.flush()) {
+        return Entry();
+    }
+
+    ++m_nextId;
+    m_live.insert(entry.id, entry.segment);
+    ++m_segmentRefs[entry.segment];
+    appendRecord(queuedRecord(entry));
+    return entry;
+}
+
+void Spool::setInFlight(quint64 id)
+{
+    if (m_live.contains(id)) {
+        appendRecord("I " + QByteArray::number(id) + '\n');
+    }
+}
+
+void Spool::finish(quint64 id, bool delivered)
+{
+    auto it = m_live.find(id);
+    if (it == m_live.end()) {
+        return;
+    }
+
+    const int segment = it.value();
+    m_live.erase(it);
+    appendRecord((delivered ? "D " : "F ") + QByteArray::number(id) + '\n');
+
+    if (--m_segmentRefs[segment] == 0) {
+        releaseSegment(segment);
+    }
+
+    if (m_live.isEmpty() && m_segment.isOpen() && m_segment.pos() >= CompactSize) {
+        // Nothing references it, the next mail starts a new one
+        closeSegment();
+    }
+}
+
+std::vector<Spool::Entry> Spool::takeRecovered()
+{
+    std::vector<Entry> ret;
+    ret.swap(m_recovered);
+    return ret;
+}
+
+std::shared_ptr<QIODevice> Spool::message(const Entry &entry) const
+{
+    return std::make_shared<SpoolMessageDevice>(
+        segmentPath(entry.segment), entry.offset, entry.length);
+}
+
+void Spool::commit()
+{
+    m_commitTimer.stop();
+
+    // The data first, so no record points to data that isn't on disk
+    if (m_segmentDirty && m_segment.isOpen() && !syncFile(m_segment)) {
+        qCWarning(SIMPLEMAIL_SPOOL) << "Failed to sync segment" << m_segment.errorString();
+    }
+    m_segmentDirty = false;
+
+    if (!m_records.isEmpty()) {
+        if (m_journal.write(m_records) != m_records.size() || !syncFile(m_journal)) {
+            qCWarning(SIMPLEMAIL_SPOOL) << "Failed to sync journal" << m_journal.errorString();
+        }
+        m_records.clear();
+    }
+
+    // Only once the records finishing their mails are on disk
+    for (int segment : qAsConst(m_obsoleteSegments)) {
+        QFile::remove(segmentPath(segment));
+    }
+    m_obsoleteSegments.clear();
+
+    if (m_live.isEmpty() && m_journal.size() > CompactSize) {
+        // Every mail in it finished
+        m_journal.resize(0);
+        syncFile(m_journal);
+    }
+}
+
+void Spool::appendRecord(const QByteArray &record)
+{
+    m_records.append(record);
+    if (!m_commitTimer.isActive()) {
+        m_commitTimer.start();
+    }
+}
+
+bool Spool::openSegment()
+{
+    m_segment.setFileName(segmentPath(m_currentSegment));
+    if (!m_segment.open(QIODevice::WriteOnly | QIODevice::Append)) {
+        qCWarning(SIMPLEMAIL_SPOOL) << "Failed to open segment" << m_segment.fileName()
+                                    << m_segment.errorString();
+        return false;
+    }
+    syncDirectory();
+    return true;
+}
+
+void Spool::closeSegment()
+{
+    if (m_segmentDirty) {
+        syncFile(m_segment);
+        m_segmentDirty = false;
+    }
+    m_segment.close();
+
+    const int segment = m_currentSegment++;
+    if (m_segmentRefs.value(segment) == 0) {
+        releaseSegment(segment);
+    }
+}
+
+void Spool::releaseSegment(int segment)
+{
+    // The open segment still receives new mails
+    if (segment == m_currentSegment && m_segment.isOpen()) {
+        return;
+    }
+
+    m_segmentRefs.remove(segment);
+    m_obsoleteSegments.append(segment);
+    if (!m_commitTimer.isActive()) {
+        m_commitTimer.start();
+    }
+}
+
+QString Spool::segmentPath(int segment) const
+{
+    const QString name = QString::number(segment).rightJustified(8, QLatin1Char('0'));
+    return m_path + QLatin1Char('/') + name + QLatin1String(".seg");
+}
+
+bool Spool::parseRecord(const QByteArray &line, QHash<quint64, Entry> &entries)
+{
+    const QList<QByteArray> fields = line.split(' ');
+    bool ok             = fields.size() >= 2;
+    const quint64 id    = ok ? fields.at(1).toULongLong(&ok) : 0;
+    const QByteArray op = fields.at(0);
+    if (!ok) {
+        return false;
+    }
+
+    if (op == "Q") {
+        // Q id priority expiry segment offset length sender recipients...
+        if (fields.size() < 8) {
+            return false;
+        }
+
+        bool valid  = true;
+        auto number = [&valid](const QByteArray &field) {
+            bool converted;
+            const qint64 ret = field.toLongLong(&converted);
+            valid            = valid && converted;
+            return ret;
+        };
+
+        Entry entry;
+        entry.id       = id;
+        entry.priority = int(number(fields.at(2)));
+        entry.expiry   = number(fields.at(3));
+        entry.segment  = int(number(fields.at(4)));
+        entry.offset   = number(fields.at(5));
+        entry.length   = number(fields.at(6));
+        entry.sender   = QUrl::fromPercentEncoding(fields.at(7));
+        for (int i = 8; i < fields.size(); ++i) {
+            entry.recipients << QUrl::fromPercentEncoding(fields.at(i));
+        }
+
+        if (!valid) {
+            return false;
+        }
+        entries.insert(id, entry);
+    } else if (op == "I") {
+        auto it = entries.find(id);
+        if (it != entries.end()) {
+            it->inFlight = true;
+        }
+    } else if (op == "D" || op == "F") {
+        entries.remove(id);
+    } else {
+        return false;
+    }
+    return true;
+}
+
+QByteArray Spool::queuedRecord(const Entry &entry)
+{
+    // Addresses are percent encoded so they never contain the separator
+    QByteArray ret = "Q " + QByteArray::number(entry.id) + ' ' +
+                     QByteArray::number(entry.priority) + ' ' + QByteArray::number(entry.expiry) +
+                     ' ' + QByteArray::number(entry.segment) + ' ' +
+                     QByteArray::number(entry.offset) + ' ' + QByteArray::number(entry.length) +
+                     ' ' + QUrl::toPercentEncoding(entry.sender, "@+");
+    for (const QString &recipient : entry.recipients) {
+        ret += ' ' + QUrl::toPercentEncoding(recipient, "@+");
+    }
+    ret += '\n';
+    return ret;
+}
+
+bool Spool::syncFile(QFile &file)
+{
+    if (!file.flush()) {
+        return false;
+    }
+
+#if defined(Q_OS_WIN)
+    return _commit(file.handle()) == 0;
+#elif defined(Q_OS_UNIX)
+    return ::fsync(file.handle()) == 0;
+#else
+    return true;
+#endif
+}
+
+void Spool::syncDirectory() const
+{
+#ifdef Q_OS_UNIX
+    // New files are only durable once their directory entry is
+    const int fd = ::open(QFile::encodeName(m_path).constData(), O_RDONLY);
+    if (fd >= 0) {
+        ::fsync(fd);
+        ::close(fd);
+    }
+#endif
+}
+
+#include "moc_spool_p.cpp"
@@ -0,0 +1,157 @@
+/*
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  See the LICENSE file for more details.
+*/
+#ifndef SPOOL_P_H
+#define SPOOL_P_H
+
+#include <memory>
+#include <vector>
+
+#include <QFile>
+#include <QHash>
+#include <QStringList>
+#include <QTimer>
+
+namespace SimpleMail {
+
+class MimeMessage;
+
+/**
+ * Read only view of the bytes of one message inside a spool segment.
+ */
+class SpoolMessageDevice : public QIODevice
+{
+    Q_OBJECT
+public:
+    SpoolMessageDevice(const QString &fileName, qint64 offset, qint64 length);
+
+    bool open(OpenMode mode) override;
+    void close() override;
+    qint64 size() const override;
+
+protected:
+    qint64 readData(char *data, qint64 maxSize) override;
+    qint64 writeData(const char *data, qint64 len) override;
+
+private:
+    QFile m_file;
+    qint64 m_offset;
+    qint64 m_length;
+};
+
+/**
+ * Keeps the queued mails of a Server on disk so they survive the process.
+ *
+ * Messages are rendered once and appended to segment files, an append
+ * only journal records each mail as queued, in flight, done or failed.
+ * Records are buffered and written with a single fsync every
+ * CommitInterval, the segments first so a queued record never points to
+ * data that isn't on disk, which keeps thousands of enqueues per second
+ * cheap at the cost of losing the last interval on a power failure.
+ *
+ * A mail found in flight when the spool is opened might have been
+ * delivered already, it's sent again as delivery is at least once.
+ */
+class Spool
+{
+public:
+    enum {
+        // Time the records wait to be committed together
+        CommitInterval = 10,
+        // Size at which a new segment file is started
+        SegmentSize = 64 * 1024 * 1024,
+        // Size at which an idle journal is truncated
+        CompactSize = 1024 * 1024,
+    };
+
+    struct Entry {
+        QString sender;
+        QStringList recipients;
+        quint64 id = 0;
+        // Milliseconds since epoch, 0 if it never expires
+        qint64 expiry = 0;
+        qint64 offset = 0;
+        qint64 length = 0;
+        int segment   = 0;
+        int priority  = 0;
+        bool inFlight = false;
+    };
+
+    Spool();
+    ~Spool();
+
+    /**
+     * Loads the journal of \p path, creating it if needed, the mails that
+     * didn't finish are kept for takeRecovered() and the journal is
+     * rewritten with only them.
+     */
+    bool open(const QString &path);
+    inline QString path() const { return m_path; }
+
+    /**
+     * Renders \p msg into the current segment and records it as queued,
+     * returns the entry of the mail which has an id of 0 on failure.
+     */
+    Entry enqueue(const MimeMessage &msg,
+                  const QStringList &recipients,
+                  int priority,
+                  qint64 expiry);
+
+    void setInFlight(quint64 id);
+    void finish(quint64 id, bool delivered);
+
+    /**
+     * Returns the unfinished mails found by open(), in the order they were queued
+     */
+    std::vector<Entry> takeRecovered();
+
+    /**
+     * Returns a device reading the rendered message of \p entry
+     */
+    std::shared_ptr<QIODevice> message(const Entry &entry) const;
+
+    /**
+     * Writes the pending records and syncs them to disk
+     */
+    void commit();
+
+private:
+    void appendRecord(const QByteArray &record);
+    bool openSegment();
+    void closeSegment();
+    void releaseSegment(int segment);
+    QString segmentPath(int segment) const;
+    static bool parseRecord(const QByteArray &line, QHash<quint64, Entry> &entries);
+    static QByteArray queuedRecord(const Entry &entry);
+    static bool syncFile(QFile &file);
+    void syncDirectory() const;
+
+    QString m_path;
+    QFile m_journal;
+    QFile m_segment;
+    QTimer m_commitTimer;
+    QByteArray m_records;
+    // Segment of each unfinished mail
+    QHash<quint64, int> m_live;
+    // Unfinished mails on each segment
+    QHash<int, int> m_segmentRefs;
+    QList<int> m_obsoleteSegments;
+    std::vector<Entry> m_recovered;
+    quint64 m_nextId     = 1;
+    int m_currentSegment = 0;
+    bool m_segmentDirty  = false;
+};
+
+} // namespace SimpleMail
+
+#endif // SPOOL_P_H
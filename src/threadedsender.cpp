@@ -0,0 +1,225 @@
+/*
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  See the LICENSE file for more details.
+*/
+#include "mimemessage_p.h"
+#include "server.h"
+#include "serverreply.h"
+#include "threadedsender_p.h"
+
+#include <QLoggingCategory>
+
+Q_LOGGING_CATEGORY(SIMPLEMAIL_THREADEDSENDER, "simplemail.threadedsender", QtInfoMsg)
+
+using namespace SimpleMail;
+
+ThreadedSender::ThreadedSender(int threads, QObject *parent)
+    : QObject(parent)
+    , d_ptr(new ThreadedSenderPrivate)
+{
+    Q_D(ThreadedSender);
+
+    if (threads < 1) {
+        threads = qMax(1, QThread::idealThreadCount());
+    }
+
+    for (int i = 0; i < threads; ++i) {
+        auto thread = std::make_unique<QThread>();
+        thread->setObjectName(QStringLiteral("SimpleMailSender%1").arg(i));
+
+        auto worker = new ThreadedSenderWorker(d);
+        worker->moveToThread(thread.get());
+        thread->start();
+
+        d->workers.push_back(worker);
+        d->threads.push_back(std::move(thread));
+    }
+    qCDebug(SIMPLEMAIL_THREADEDSENDER) << "Started" << threads << "worker threads";
+}
+
+ThreadedSender::~ThreadedSender()
+{
+    delete d_ptr;
+}
+
+void ThreadedSender::setServerSetup(const std::function<void(Server *)> &setup)
+{
+    Q_D(ThreadedSender);
+    QMutexLocker locker(&d->setupMutex);
+    d->setup = setup;
+}
+
+int ThreadedSender::threadCount() const
+{
+    Q_D(const ThreadedSender);
+    return int(d->workers.size());
+}
+
+ServerReply *ThreadedSender::sendMail(const MimeMessage &msg)
+{
+    return sendMail(msg, Server::SendOptions());
+}
+
+ServerReply *ThreadedSender::sendMail(const MimeMessage &msg, const Server::SendOptions &options)
+{
+    Q_D(ThreadedSender);
+
+    auto reply  = new ServerReply;
+    auto handle = std::make_shared<ThreadedReplyHandle>();
+    handle->reply = reply;
+    connect(reply, &QObject::destroyed, [handle] {
+        QMutexLocker locker(&handle->mutex);
+        handle->reply = nullptr;
+    });
+
+    ThreadedSenderWorker *worker = nullptr;
+    int load                     = 0;
+    for (ThreadedSenderWorker *candidate : d->workers) {
+        const int pending = candidate->pending.load(std::memory_order_relaxed);
+        if (!worker || pending < load) {
+            worker = candidate;
+            load   = pending;
+        }
+    }
+
+    worker->pending.fetch_add(1, std::memory_order_relaxed);
+    // The worker must not read the content devices the caller might still use
+    worker->queue.push(std::make_unique<ThreadedSenderJob>(
+        MimeMessagePrivate::detachedCopy(msg), options, handle));
+    worker->schedule();
+
+    return reply;
+}
+
+int ThreadedSender::queueSize() const
+{
+    Q_D(const ThreadedSender);
+    int ret = 0;
+    for (const ThreadedSenderWorker *worker : d->workers) {
+        ret += worker->pending.load(std::memory_order_relaxed);
+    }
+    return ret;
+}
+
+void ThreadedSenderWorker::schedule()
+{
+    // Only wake the worker thread if it's not already going to drain the queue
+    if (!scheduled.exchange(true)) {
+        QMetaObject::invokeMethod(this, [this] { drain(); }, Qt::QueuedConnection);
+    }
+}
+
+void ThreadedSenderWorker::drain()
+{
+    if (!server) {
+        server = new Server(this);
+        const auto setup = sender->serverSetup();
+        if (setup) {
+            setup(server);
+        }
+    }
+
+    // Cleared before popping so that a push racing with us schedules a new drain
+    scheduled.store(false);
+
+    std::unique_ptr<ThreadedSenderJob> job;
+    while (queue.pop(job)) {
+        ServerReply *serverReply = server->sendMail(job->msg, job->options);
+        const auto handle        = job->handle;
+        active.insert(serverReply, handle);
+        connect(serverReply, &ServerReply::finished, this, [this, handle, serverReply] {
+            finishJob(handle, serverReply);
+        });
+    }
+}
+
+void ThreadedSenderWorker::finishJob(const std::shared_ptr<ThreadedReplyHandle> &handle,
+                                     ServerReply *serverReply)
+{
+    active.remove(serverReply);
+    finishHandle(handle,
+                 serverReply->error(),
+                 serverReply->responseCode(),
+                 serverReply->responseText(),
+                 serverReply->recipientStatus());
+    serverReply->deleteLater();
+}
+
+void ThreadedSenderWorker::finishHandle(const std::shared_ptr<ThreadedReplyHandle> &handle,
+                                        bool error,
+                                        int code,
+                                        const QString &text,
+                                        const QList<ServerReply::RecipientStatus> &recipients)
+{
+    {
+        QMutexLocker locker(&handle->mutex);
+        if (handle->reply) {
+            // Queued events are discarded if the reply gets deleted before delivery
+            QMetaObject::invokeMethod(
+                handle->reply,
+                [handle, error, code, text, recipients] {
+                    handle->reply->setRecipientStatus(recipients);
+                    handle->reply->finish(error, code, text);
+                },
+                Qt::QueuedConnection);
+        }
+    }
+
+    pending.fetch_sub(1, std::memory_order_relaxed);
+}
+
+void ThreadedSenderWorker::shutdown()
+{
+    const QString text = ThreadedSender::tr("Sender destroyed before the mail was sent");
+
+    // Mails the server never got
+    std::unique_ptr<ThreadedSenderJob> job;
+    while (queue.pop(job)) {
+        finishHandle(job->handle, true, -1, text, {});
+    }
+
+    for (auto it = active.constBegin(); it != active.constEnd(); ++it) {
+        ServerReply *serverReply = it.key();
+        serverReply->disconnect(this);
+        finishHandle(it.value(), true, -1, text, serverReply->recipientStatus());
+    }
+    active.clear();
+
+    // The socket and timers are closed from the thread they live in
+    delete server;
+    server = nullptr;
+}
+
+ThreadedSenderPrivate::~ThreadedSenderPrivate()
+{
+    for (size_t i = 0; i < workers.size(); ++i) {
+        ThreadedSenderWorker *worker = workers[i];
+        QThread *thread              = threads[i].get();
+        QMetaObject::invokeMethod(
+            worker, [worker] { worker->shutdown(); }, Qt::BlockingQueuedConnection);
+
+        // Deleted by it's own thread once the event loop quits
+        QObject::connect(thread, &QThread::finished, worker, &QObject::deleteLater);
+        thread->quit();
+    }
+    for (auto &thread : threads) {
+        thread->wait();
+    }
+}
+
+std::function<void(Server *)> ThreadedSenderPrivate::serverSetup() const
+{
+    QMutexLocker locker(&setupMutex);
+    return setup;
+}
+
+#include "moc_threadedsender.cpp"
@@ -0,0 +1,93 @@
+/*
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  See the LICENSE file for more details.
+*/
+#pragma once
+
+#include "server.h"
+#include "smtpexports.h"
+
+#include <functional>
+
+#include <QObject>
+
+namespace SimpleMail {
+
+class MimeMessage;
+class ServerReply;
+class ThreadedSenderPrivate;
+class SMTP_EXPORT ThreadedSender : public QObject
+{
+    Q_OBJECT
+    Q_DECLARE_PRIVATE(ThreadedSender)
+public:
+    /**
+     * Creates a sender with \p threads worker threads, each one
+     * owning it's own Server and socket, if \p threads is smaller than 1
+     * QThread::idealThreadCount() is used.
+     */
+    explicit ThreadedSender(int threads = 0, QObject *parent = nullptr);
+
+    /**
+     * Stops all worker threads, the replies of emails not yet sent
+     * finish with an error once the calling thread's event loop runs
+     */
+    virtual ~ThreadedSender();
+
+    /**
+     * Defines the function used to configure each worker's Server,
+     * it's called on the worker thread right after the Server is created,
+     * so it's the place to set host, credentials and to connect to
+     * signals like Server::sslErrors() with a Qt::DirectConnection.
+     *
+     * Must be called before the first sendMail().
+     */
+    void setServerSetup(const std::function<void(Server *server)> &setup);
+
+    /**
+     * Returns the number of worker threads
+     */
+    int threadCount() const;
+
+    /**
+     * Sends the email async on the least loaded worker thread.
+     *
+     * This method is thread safe, the returned reply lives on the
+     * calling thread and it's finished() signal is emitted there,
+     * so the calling thread must run an event loop.
+     *
+     * The content of the message parts is copied before this returns,
+     * files are opened again by name and other devices are read into
+     * memory, so the message and it's parts can be used or sent again
+     * right away.
+     *
+     * You must delete the returned object, if you do so before
+     * it's finished() signal is emited the result is discarded.
+     */
+    ServerReply *sendMail(const MimeMessage &msg);
+
+    /**
+     * Sends the email async with the given options on the least loaded
+     * worker thread, see Server::sendMail()
+     */
+    ServerReply *sendMail(const MimeMessage &msg, const Server::SendOptions &options);
+
+    /**
+     * Returns the number of emails not yet finished on all workers
+     */
+    int queueSize() const;
+
+private:
+    ThreadedSenderPrivate *d_ptr;
+};
+
+} // namespace SimpleMail
@@ -0,0 +1,106 @@
+/*
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  See the LICENSE file for more details.
+*/
+#ifndef THREADEDSENDER_P_H
+#define THREADEDSENDER_P_H
+
+#include "mimemessage.h"
+#include "mpscqueue_p.h"
+#include "serverreply.h"
+#include "threadedsender.h"
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include <QHash>
+#include <QMutex>
+#include <QThread>
+
+namespace SimpleMail {
+
+/**
+ * Links a ServerReply living on the submitting thread with the
+ * worker, the worker only touches the reply while holding the mutex
+ * and the reply clears itself from here when destroyed.
+ */
+class ThreadedReplyHandle
+{
+public:
+    QMutex mutex;
+    ServerReply *reply = nullptr;
+};
+
+class ThreadedSenderJob
+{
+public:
+    ThreadedSenderJob(const MimeMessage &email,
+                      const Server::SendOptions &opts,
+                      const std::shared_ptr<ThreadedReplyHandle> &h)
+        : msg(email)
+        , options(opts)
+        , handle(h)
+    {
+    }
+
+    MimeMessage msg;
+    Server::SendOptions options;
+    std::shared_ptr<ThreadedReplyHandle> handle;
+};
+
+class ThreadedSenderPrivate;
+class ThreadedSenderWorker : public QObject
+{
+public:
+    ThreadedSenderWorker(ThreadedSenderPrivate *sender)
+        : sender(sender)
+    {
+    }
+
+    void schedule();
+    void drain();
+    void finishJob(const std::shared_ptr<ThreadedReplyHandle> &handle, ServerReply *serverReply);
+    void finishHandle(const std::shared_ptr<ThreadedReplyHandle> &handle,
+                      bool error,
+                      int code,
+                      const QString &text,
+                      const QList<ServerReply::RecipientStatus> &recipients);
+
+    // Fails the mails not finished yet and deletes the server, must run on the worker thread
+    void shutdown();
+
+    MpscQueue<std::unique_ptr<ThreadedSenderJob>> queue;
+    // Replies of the server that didn't finish yet
+    QHash<ServerReply *, std::shared_ptr<ThreadedReplyHandle>> active;
+    std::atomic<bool> scheduled{false};
+    std::atomic<int> pending{0};
+    ThreadedSenderPrivate *sender;
+    Server *server = nullptr;
+};
+
+class ThreadedSenderPrivate
+{
+public:
+    ~ThreadedSenderPrivate();
+
+    std::function<void(Server *)> serverSetup() const;
+
+    std::vector<std::unique_ptr<QThread>> threads;
+    std::vector<ThreadedSenderWorker *> workers;
+    mutable QMutex setupMutex;
+    std::function<void(Server *)> setup;
+};
+
+} // namespace SimpleMail
+
+#endif // THREADEDSENDER_P_H